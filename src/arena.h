@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Bump allocator over a fixed block of memory owned by the plugin. Allocations are never
+// freed one by one, the whole arena is reset at once, or rewound to an earlier position for
+// scratch memory used like a stack. Nothing here touches the title heap
+class Arena
+{
+public:
+    Arena(void *pMemory, size_t capacity)
+        : m_pMemory(static_cast<uint8_t *>(pMemory)), m_Capacity(capacity), m_Position(0), m_Peak(0), m_Failures(0)
+    {
+    }
+
+    // Returns nullptr when the arena is full, alignment must be a power of 2
+    void *Allocate(size_t size, size_t alignment = 8)
+    {
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_pMemory);
+        uintptr_t start = (base + m_Position + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        size_t end = static_cast<size_t>(start - base) + size;
+
+        if (end > m_Capacity)
+        {
+            m_Failures++;
+            return nullptr;
+        }
+
+        m_Position = end;
+        if (m_Position > m_Peak)
+            m_Peak = m_Position;
+
+        return reinterpret_cast<void *>(start);
+    }
+
+    template<typename T>
+    T *AllocateArray(size_t count)
+    {
+        return static_cast<T *>(Allocate(sizeof(T) * count, __alignof(T)));
+    }
+
+    size_t GetPosition() const { return m_Position; }
+
+    // Frees everything allocated after position was read with GetPosition
+    void Rewind(size_t position)
+    {
+        if (position < m_Position)
+            m_Position = position;
+    }
+
+    void Reset()
+    {
+        m_Position = 0;
+    }
+
+    bool Owns(const void *pPointer) const
+    {
+        const uint8_t *pByte = static_cast<const uint8_t *>(pPointer);
+        return pByte >= m_pMemory && pByte < m_pMemory + m_Capacity;
+    }
+
+    size_t GetUsedBytes() const { return m_Position; }
+
+    size_t GetPeakBytes() const { return m_Peak; }
+
+    size_t GetCapacity() const { return m_Capacity; }
+
+    uint32_t GetFailureCount() const { return m_Failures; }
+
+private:
+    uint8_t *m_pMemory;
+    size_t m_Capacity;
+    size_t m_Position;
+    size_t m_Peak;
+    uint32_t m_Failures;
+};
+
+// Fixed number of T carved out of an arena, with an intrusive free list so allocating and
+// freeing are O(1). Objects are constructed by the caller with placement new on the memory
+// returned by AllocateRaw, or default constructed by Allocate
+template<typename T>
+class ObjectPool
+{
+public:
+    ObjectPool()
+        : m_pSlots(nullptr), m_pFreeList(nullptr), m_Capacity(0), m_Live(0), m_Peak(0), m_Failures(0)
+    {
+    }
+
+    bool Init(Arena *pArena, size_t capacity)
+    {
+        m_pSlots = pArena->AllocateArray<Slot>(capacity);
+        if (m_pSlots == nullptr)
+            return false;
+
+        m_Capacity = capacity;
+        Reset();
+        return true;
+    }
+
+    // Forgets every object without running destructors, used when the memory goes away
+    void Reset()
+    {
+        m_pFreeList = nullptr;
+        for (size_t i = m_Capacity; i > 0; i--)
+        {
+            m_pSlots[i - 1].pNext = m_pFreeList;
+            m_pFreeList = &m_pSlots[i - 1];
+        }
+
+        m_Live = 0;
+    }
+
+    void *AllocateRaw()
+    {
+        if (m_pFreeList == nullptr)
+        {
+            m_Failures++;
+            return nullptr;
+        }
+
+        Slot *pSlot = m_pFreeList;
+        m_pFreeList = pSlot->pNext;
+
+        m_Live++;
+        if (m_Live > m_Peak)
+            m_Peak = m_Live;
+
+        return pSlot->storage;
+    }
+
+    T *Allocate()
+    {
+        void *pMemory = AllocateRaw();
+        return pMemory != nullptr ? new (pMemory) T() : nullptr;
+    }
+
+    void Free(T *pObject)
+    {
+        if (pObject == nullptr)
+            return;
+
+        pObject->~T();
+
+        Slot *pSlot = reinterpret_cast<Slot *>(pObject);
+        pSlot->pNext = m_pFreeList;
+        m_pFreeList = pSlot;
+        m_Live--;
+    }
+
+    bool Owns(const void *pPointer) const
+    {
+        const Slot *pSlot = static_cast<const Slot *>(pPointer);
+        return pSlot >= m_pSlots && pSlot < m_pSlots + m_Capacity;
+    }
+
+    size_t GetLiveCount() const { return m_Live; }
+
+    size_t GetPeakCount() const { return m_Peak; }
+
+    size_t GetCapacity() const { return m_Capacity; }
+
+    uint32_t GetFailureCount() const { return m_Failures; }
+
+private:
+    union Slot
+    {
+        Slot *pNext;
+        double alignment;
+        uint8_t storage[sizeof(T)];
+    };
+
+    Slot *m_pSlots;
+    Slot *m_pFreeList;
+    size_t m_Capacity;
+    size_t m_Live;
+    size_t m_Peak;
+    uint32_t m_Failures;
+};
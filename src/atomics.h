@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_XBOX)
+    #include <xtl.h>
+#else
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#endif
+
+// Xenon has 128 byte cache lines, data written by different hardware threads should be
+// kept on separate lines
+#define CACHE_LINE_SIZE 128
+
+#if defined(_XBOX)
+    #define CACHE_ALIGN __declspec(align(CACHE_LINE_SIZE))
+#else
+    #define CACHE_ALIGN __attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
+// Small set of atomic operations that work with the Xbox 360 compiler, which predates
+// <atomic>, and with GCC/Clang so the lock-free code can be built and tested on a host.
+// The Interlocked functions don't contain CPU memory barriers on Xenon so the ordering is
+// made explicit with lwsync
+
+inline int32_t Atomic_LoadAcquire(const volatile int32_t *pValue)
+{
+#if defined(_XBOX)
+    int32_t value = *pValue;
+    __lwsync();
+    return value;
+#else
+    return __atomic_load_n(pValue, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void Atomic_StoreRelease(volatile int32_t *pValue, int32_t value)
+{
+#if defined(_XBOX)
+    __lwsync();
+    *pValue = value;
+#else
+    __atomic_store_n(pValue, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Returns the value that was in pValue before the operation, the exchange happened if it's
+// equal to comparand
+inline int32_t Atomic_CompareExchange(volatile int32_t *pValue, int32_t exchange, int32_t comparand)
+{
+#if defined(_XBOX)
+    __lwsync();
+    int32_t previous = InterlockedCompareExchange(reinterpret_cast<volatile LONG *>(pValue), exchange, comparand);
+    __lwsync();
+    return previous;
+#else
+    __atomic_compare_exchange_n(pValue, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+#endif
+}
+
+// Returns the value after the addition
+inline int32_t Atomic_Add(volatile int32_t *pValue, int32_t amount)
+{
+#if defined(_XBOX)
+    __lwsync();
+    int32_t result = InterlockedExchangeAdd(reinterpret_cast<volatile LONG *>(pValue), amount) + amount;
+    __lwsync();
+    return result;
+#else
+    return __atomic_add_fetch(pValue, amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline int32_t Atomic_Increment(volatile int32_t *pValue)
+{
+    return Atomic_Add(pValue, 1);
+}
+
+// Unsigned versions for counters that are meant to wrap around, like queue positions
+inline uint32_t Atomic_LoadAcquire(const volatile uint32_t *pValue)
+{
+    return static_cast<uint32_t>(Atomic_LoadAcquire(reinterpret_cast<const volatile int32_t *>(pValue)));
+}
+
+inline void Atomic_StoreRelease(volatile uint32_t *pValue, uint32_t value)
+{
+    Atomic_StoreRelease(reinterpret_cast<volatile int32_t *>(pValue), static_cast<int32_t>(value));
+}
+
+inline uint32_t Atomic_CompareExchange(volatile uint32_t *pValue, uint32_t exchange, uint32_t comparand)
+{
+    return static_cast<uint32_t>(Atomic_CompareExchange(reinterpret_cast<volatile int32_t *>(pValue), static_cast<int32_t>(exchange), static_cast<int32_t>(comparand)));
+}
+
+// Orders every load and store before it with every one after it, stores before loads
+// included which lwsync doesn't do
+inline void Atomic_FullBarrier()
+{
+#if defined(_XBOX)
+    __sync();
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void Thread_Yield()
+{
+#if defined(_XBOX)
+    Sleep(0);
+#else
+    sched_yield();
+#endif
+}
+
+inline void Thread_Sleep(uint32_t milliseconds)
+{
+#if defined(_XBOX)
+    Sleep(milliseconds);
+#else
+    usleep(milliseconds * 1000);
+#endif
+}
+
+inline uint32_t Thread_GetCurrentId()
+{
+#if defined(_XBOX)
+    return GetCurrentThreadId();
+#else
+    return static_cast<uint32_t>(syscall(SYS_gettid));
+#endif
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_XBOX)
+    #include <xtl.h>
+#endif
+
+#define LOG_HISTOGRAM_BUCKETS 24
+
+inline uint32_t CountLeadingZeros(uint32_t value)
+{
+#if defined(_XBOX)
+    return _CountLeadingZeros(value);
+#else
+    return value != 0 ? __builtin_clz(value) : 32;
+#endif
+}
+
+// Counts values in power of 2 buckets, bucket 0 holds 0 and bucket i holds [2^(i-1), 2^i).
+// Adding a value is a cntlzw and an increment so it can sit on hot paths, percentiles are
+// only as precise as the bucket they fall in. The last bucket also holds everything above
+class LogHistogram
+{
+public:
+    LogHistogram()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        memset(m_Buckets, 0, sizeof(m_Buckets));
+        m_Count = 0;
+        m_Max = 0;
+        m_Sum = 0;
+    }
+
+    static int GetBucket(uint32_t value)
+    {
+        int bucket = 32 - static_cast<int>(CountLeadingZeros(value));
+        return bucket < LOG_HISTOGRAM_BUCKETS ? bucket : LOG_HISTOGRAM_BUCKETS - 1;
+    }
+
+    // Smallest and largest values that land in the bucket
+    static uint32_t GetBucketLow(int bucket)
+    {
+        return bucket != 0 ? 1u << (bucket - 1) : 0;
+    }
+
+    static uint32_t GetBucketHigh(int bucket)
+    {
+        return bucket != 0 ? (1u << (bucket - 1)) * 2 - 1 : 0;
+    }
+
+    void Add(uint32_t value)
+    {
+        m_Buckets[GetBucket(value)]++;
+        m_Count++;
+        m_Sum += value;
+        if (value > m_Max)
+            m_Max = value;
+    }
+
+    void Merge(const LogHistogram &other)
+    {
+        for (int i = 0; i < LOG_HISTOGRAM_BUCKETS; i++)
+            m_Buckets[i] += other.m_Buckets[i];
+
+        m_Count += other.m_Count;
+        m_Sum += other.m_Sum;
+        if (other.m_Max > m_Max)
+            m_Max = other.m_Max;
+    }
+
+    // Upper bound of the bucket the percentile falls in, never more than the largest value
+    // added. 100 gives the largest value
+    uint32_t GetPercentile(uint32_t percentile) const
+    {
+        if (m_Count == 0)
+            return 0;
+
+        if (percentile >= 100)
+            return m_Max;
+
+        uint32_t target = static_cast<uint32_t>((static_cast<uint64_t>(m_Count) * percentile + 99) / 100);
+        if (target == 0)
+            target = 1;
+
+        uint32_t seen = 0;
+        for (int i = 0; i < LOG_HISTOGRAM_BUCKETS; i++)
+        {
+            seen += m_Buckets[i];
+            if (seen >= target)
+                return GetBucketHigh(i) < m_Max ? GetBucketHigh(i) : m_Max;
+        }
+
+        return m_Max;
+    }
+
+    uint32_t GetBucketCount(int bucket) const { return m_Buckets[bucket]; }
+
+    uint32_t GetCount() const { return m_Count; }
+
+    uint32_t GetMax() const { return m_Max; }
+
+    uint32_t GetMean() const { return m_Count != 0 ? static_cast<uint32_t>(m_Sum / m_Count) : 0; }
+
+private:
+    uint32_t m_Buckets[LOG_HISTOGRAM_BUCKETS];
+    uint32_t m_Count;
+    uint32_t m_Max;
+    uint64_t m_Sum;
+};
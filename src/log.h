@@ -0,0 +1,379 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "atomics.h"
+#include "timebase.h"
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below this level are compiled out entirely
+#if !defined(LOG_MIN_LEVEL)
+    #if defined(NDEBUG)
+        #define LOG_MIN_LEVEL LOG_LEVEL_INFO
+    #else
+        #define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+    #endif
+#endif
+
+#define MAX_LOG_THREADS 8
+#define LOG_RING_CAPACITY 256 // Must be a power of 2
+#define MAX_LOG_ARGS 4
+#define LOG_TEXT_LENGTH 28
+#define MAX_LOG_LINE_LENGTH 512
+
+enum LogArgType
+{
+    LOG_ARG_NONE,
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_FLOAT,
+    LOG_ARG_STRING, // Pointer to a string that outlives the record, like a literal
+    LOG_ARG_TEXT,   // Copied into the record, see LogText
+};
+
+union LogArgValue
+{
+    int32_t i;
+    uint32_t u;
+    float f;
+    const char *s;
+};
+
+// Wraps a transient string so it's copied into the record instead of referenced. Only one
+// per record and it's truncated to LOG_TEXT_LENGTH - 1 characters
+struct LogText
+{
+    explicit LogText(const char *text)
+        : text(text)
+    {
+    }
+
+    const char *text;
+};
+
+// Converts log call arguments without formatting them
+struct LogArg
+{
+    LogArgType type;
+    LogArgValue value;
+    const char *text;
+
+    LogArg()
+        : type(LOG_ARG_NONE), text(nullptr) { value.u = 0; }
+
+    LogArg(int i)
+        : type(LOG_ARG_INT), text(nullptr) { value.i = i; }
+
+    LogArg(long i)
+        : type(LOG_ARG_INT), text(nullptr) { value.i = static_cast<int32_t>(i); }
+
+    LogArg(unsigned int u)
+        : type(LOG_ARG_UINT), text(nullptr) { value.u = u; }
+
+    LogArg(unsigned long u)
+        : type(LOG_ARG_UINT), text(nullptr) { value.u = static_cast<uint32_t>(u); }
+
+    LogArg(float f)
+        : type(LOG_ARG_FLOAT), text(nullptr) { value.f = f; }
+
+    LogArg(double f)
+        : type(LOG_ARG_FLOAT), text(nullptr) { value.f = static_cast<float>(f); }
+
+    LogArg(const char *s)
+        : type(LOG_ARG_STRING), text(nullptr) { value.s = s; }
+
+    LogArg(const LogText &logText)
+        : type(LOG_ARG_TEXT), text(logText.text) { value.u = 0; }
+};
+
+struct LogRecord
+{
+    uint64_t time;
+    const char *format;
+    LogArgValue args[MAX_LOG_ARGS];
+    uint8_t argTypes[MAX_LOG_ARGS];
+    uint8_t level;
+    char text[LOG_TEXT_LENGTH];
+};
+
+// Single-producer single-consumer ring, the producer is the thread that owns the slot and
+// the consumer is the drainer
+struct LogRing
+{
+    CACHE_ALIGN volatile uint32_t head; // Written by the producer
+    CACHE_ALIGN volatile uint32_t tail; // Written by the drainer
+    volatile int32_t dropped;
+    volatile int32_t threadId;
+    LogRecord records[LOG_RING_CAPACITY];
+};
+
+typedef void (*LogSink)(const char *line, void *pContext);
+
+class Logger
+{
+public:
+    Logger()
+        : m_RingCount(0), m_UnregisteredDrops(0), m_Written(0)
+    {
+        memset(m_Rings, 0, sizeof(m_Rings));
+    }
+
+    // Called from hot paths, copies the arguments into the calling thread's ring. If the ring
+    // is full the record is dropped and counted instead of blocking the caller
+    void Write(uint8_t level, const char *format, const LogArg &arg0, const LogArg &arg1, const LogArg &arg2, const LogArg &arg3)
+    {
+        LogRing *pRing = GetThreadRing();
+        if (pRing == nullptr)
+        {
+            Atomic_Increment(&m_UnregisteredDrops);
+            return;
+        }
+
+        // Positions wrap around, only the difference is meaningful
+        uint32_t head = pRing->head;
+        if (head - Atomic_LoadAcquire(&pRing->tail) >= LOG_RING_CAPACITY)
+        {
+            Atomic_Increment(&pRing->dropped);
+            return;
+        }
+
+        LogRecord *pRecord = &pRing->records[head & (LOG_RING_CAPACITY - 1)];
+        pRecord->time = ReadTimeBase();
+        pRecord->format = format;
+        pRecord->level = level;
+        pRecord->text[0] = '\0';
+
+        const LogArg *args[MAX_LOG_ARGS] = { &arg0, &arg1, &arg2, &arg3 };
+        for (size_t i = 0; i < MAX_LOG_ARGS; i++)
+        {
+            pRecord->argTypes[i] = static_cast<uint8_t>(args[i]->type);
+            pRecord->args[i] = args[i]->value;
+
+            if (args[i]->type == LOG_ARG_TEXT)
+            {
+                strncpy(pRecord->text, args[i]->text, LOG_TEXT_LENGTH - 1);
+                pRecord->text[LOG_TEXT_LENGTH - 1] = '\0';
+            }
+        }
+
+        Atomic_StoreRelease(&pRing->head, head + 1);
+    }
+
+    // Formats every pending record and hands the lines to the sink, only one thread may drain.
+    // Returns the number of records written
+    size_t Drain(LogSink sink, void *pContext)
+    {
+        size_t count = 0;
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+        {
+            LogRing *pRing = &m_Rings[i];
+            uint32_t tail = pRing->tail;
+            uint32_t head = Atomic_LoadAcquire(&pRing->head);
+
+            for (; tail != head; tail++)
+            {
+                char line[MAX_LOG_LINE_LENGTH];
+                FormatRecord(&pRing->records[tail & (LOG_RING_CAPACITY - 1)], pRing->threadId, line, sizeof(line));
+                sink(line, pContext);
+                count++;
+            }
+
+            Atomic_StoreRelease(&pRing->tail, tail);
+        }
+
+        m_Written += count;
+        return count;
+    }
+
+    uint32_t GetDroppedCount() const
+    {
+        uint32_t dropped = Atomic_LoadAcquire(&m_UnregisteredDrops);
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+            dropped += Atomic_LoadAcquire(&m_Rings[i].dropped);
+
+        return dropped;
+    }
+
+    uint64_t GetWrittenCount() const { return m_Written; }
+
+private:
+    LogRing m_Rings[MAX_LOG_THREADS];
+    volatile int32_t m_RingCount;
+    volatile int32_t m_UnregisteredDrops;
+    uint64_t m_Written;
+
+    // Every thread that logs gets its own ring the first time it writes. Rings are never
+    // released, the plugin only ever sees a handful of game threads
+    LogRing *GetThreadRing()
+    {
+        int32_t threadId = static_cast<int32_t>(Thread_GetCurrentId());
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+        {
+            if (Atomic_LoadAcquire(&m_Rings[i].threadId) == threadId)
+                return &m_Rings[i];
+        }
+
+        for (;;)
+        {
+            if (ringCount >= MAX_LOG_THREADS)
+                return nullptr;
+
+            int32_t previous = Atomic_CompareExchange(&m_RingCount, ringCount + 1, ringCount);
+            if (previous == ringCount)
+            {
+                // The drainer may already see the ring, it just won't find anything in it
+                // until the first record is published
+                Atomic_StoreRelease(&m_Rings[ringCount].threadId, threadId);
+                return &m_Rings[ringCount];
+            }
+
+            ringCount = previous;
+        }
+    }
+
+    static const char *GetLevelName(uint8_t level)
+    {
+        static const char *levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+        return level <= LOG_LEVEL_ERROR ? levelNames[level] : "?";
+    }
+
+    static void Append(char *buffer, size_t bufferSize, size_t *pLength, const char *format, ...)
+    {
+        if (*pLength >= bufferSize - 1)
+            return;
+
+        va_list args;
+        va_start(args, format);
+#if defined(_XBOX)
+        int written = _vsnprintf_s(&buffer[*pLength], bufferSize - *pLength, _TRUNCATE, format, args);
+#else
+        int written = vsnprintf(&buffer[*pLength], bufferSize - *pLength, format, args);
+#endif
+        va_end(args);
+
+        // Both report truncation differently, either way the buffer is full
+        if (written < 0 || static_cast<size_t>(written) >= bufferSize - *pLength)
+            *pLength = bufferSize - 1;
+        else
+            *pLength += written;
+    }
+
+    // Expands the format one conversion at a time since every argument is typed separately
+    static void FormatRecord(const LogRecord *pRecord, int32_t threadId, char *buffer, size_t bufferSize)
+    {
+        static uint64_t ticksPerMs = GetTimeBaseFrequency() / 1000;
+
+        size_t length = 0;
+        uint64_t timeMs = pRecord->time / ticksPerMs;
+        Append(buffer, bufferSize, &length, "[%u.%03u][%s][%x] ", static_cast<uint32_t>(timeMs / 1000), static_cast<uint32_t>(timeMs % 1000), GetLevelName(pRecord->level), threadId);
+
+        size_t argIndex = 0;
+        const char *cursor = pRecord->format;
+
+        while (*cursor != '\0' && length < bufferSize - 1)
+        {
+            if (*cursor != '%' || cursor[1] == '%')
+            {
+                buffer[length++] = *cursor;
+                cursor += *cursor == '%' ? 2 : 1;
+                continue;
+            }
+
+            // Copy the conversion spec, flags and width included, up to its type character.
+            // Length modifiers are left out since every value is 32 bits, a '*' width would
+            // read an argument that was never recorded
+            static const char conversions[] = "diuxXfgcs";
+            char spec[16];
+            size_t specLength = 1;
+            size_t scanned = 1;
+            bool starWidth = false;
+            spec[0] = '%';
+            while (cursor[scanned] != '\0' && specLength < sizeof(spec) - 2 && strchr(conversions, cursor[scanned]) == nullptr)
+            {
+                char c = cursor[scanned++];
+                if (c == '*')
+                    starWidth = true;
+                else if (strchr("hlLjzt", c) == nullptr)
+                    spec[specLength++] = c;
+            }
+
+            if (cursor[scanned] == '\0' || strchr(conversions, cursor[scanned]) == nullptr)
+                break;
+
+            char conversion = cursor[scanned++];
+            spec[specLength++] = conversion;
+            spec[specLength] = '\0';
+            cursor += scanned;
+
+            if (argIndex >= MAX_LOG_ARGS)
+            {
+                Append(buffer, bufferSize, &length, "<missing>");
+                continue;
+            }
+
+            // The spec decides how the value is read, it's only used when the recorded type
+            // agrees with it. A %s paired with an integer would otherwise be dereferenced
+            LogArgValue value = pRecord->args[argIndex];
+            uint8_t type = pRecord->argTypes[argIndex++];
+            bool isInteger = type == LOG_ARG_INT || type == LOG_ARG_UINT;
+
+            if (type == LOG_ARG_NONE)
+                Append(buffer, bufferSize, &length, "<missing>");
+            else if (starWidth)
+                Append(buffer, bufferSize, &length, "<type mismatch>");
+            else if (strchr("diuxXc", conversion) != nullptr && isInteger)
+                Append(buffer, bufferSize, &length, spec, value.u);
+            else if ((conversion == 'f' || conversion == 'g') && type == LOG_ARG_FLOAT)
+                Append(buffer, bufferSize, &length, spec, static_cast<double>(value.f));
+            else if (conversion == 's' && type == LOG_ARG_STRING)
+                Append(buffer, bufferSize, &length, spec, value.s != nullptr ? value.s : "(null)");
+            else if (conversion == 's' && type == LOG_ARG_TEXT)
+                Append(buffer, bufferSize, &length, spec, pRecord->text);
+            else
+                Append(buffer, bufferSize, &length, "<type mismatch>");
+        }
+
+        buffer[length] = '\0';
+    }
+};
+
+extern Logger g_Logger;
+
+inline void Log_Write(uint8_t level, const char *format, const LogArg &arg0 = LogArg(), const LogArg &arg1 = LogArg(), const LogArg &arg2 = LogArg(), const LogArg &arg3 = LogArg())
+{
+    g_Logger.Write(level, format, arg0, arg1, arg2, arg3);
+}
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+    #define LOG_DEBUG(...) Log_Write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+    #define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+    #define LOG_INFO(...) Log_Write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+    #define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+    #define LOG_WARN(...) Log_Write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+    #define LOG_WARN(...) ((void)0)
+#endif
+
+#define LOG_ERROR(...) Log_Write(LOG_LEVEL_ERROR, __VA_ARGS__)
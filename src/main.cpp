@@ -1,9 +1,23 @@
 #include <xtl.h>
 #include <string>
 #include <cstdint>
-#include <iostream>
+#include <cstdio>
+#include <cstdarg>
 #include <cstddef>
+#include <cctype>
+#include <cmath>
 #include <cassert>
+#include <algorithm>
+
+#include "timebase.h"
+#include "thread_pool.h"
+#include "log.h"
+#include "simd.h"
+#include "trajectory.h"
+#include "arena.h"
+#include "histogram.h"
+#include "trace.h"
+#include "metrics.h"
 
 // Get the address of a function from a module by its ordinal
 void *ResolveFunction(const std::string &moduleName, uint32_t ordinal)
@@ -43,8 +57,75 @@ extern "C"
 }
 
 void InitIW3();
+void ReleaseIW3();
+void ShutdownPlugin();
 
 bool g_Running = true;
+bool g_IW3Loaded = false;
+volatile bool g_MonitorStopped = false;
+volatile bool g_LogStopped = false;
+
+#define LOG_FILE_PATH "hdd:\\iw3xenon.log"
+#define LOG_DRAIN_INTERVAL_MS 50
+
+Logger g_Logger;
+Tracer g_Tracer;
+FILE *g_pLogFile = nullptr;
+
+void WriteLogLine(const char *line, void *pContext)
+{
+    OutputDebugString(line);
+    OutputDebugString("\n");
+
+    if (g_pLogFile != nullptr)
+    {
+        fputs(line, g_pLogFile);
+        fputc('\n', g_pLogFile);
+    }
+}
+
+// Formats and writes the records game threads queued with the LOG_* macros, so the
+// threads that log never wait on I/O. The file is opened and closed here rather than in
+// DllMain to keep file I/O out of the loader lock, it's optional since the drive may not
+// be mounted
+uint32_t DrainLog(void *pThreadParameter)
+{
+    uint32_t reportedDrops = 0;
+
+    fopen_s(&g_pLogFile, LOG_FILE_PATH, "a");
+
+    while (g_Running)
+    {
+        size_t count = g_Logger.Drain(WriteLogLine, nullptr);
+
+        uint32_t drops = g_Logger.GetDroppedCount();
+        if (drops != reportedDrops)
+        {
+            char line[64];
+            _snprintf_s(line, _TRUNCATE, "[log] %u records dropped", drops - reportedDrops);
+            WriteLogLine(line, nullptr);
+            reportedDrops = drops;
+            count++;
+        }
+
+        if (count != 0 && g_pLogFile != nullptr)
+            fflush(g_pLogFile);
+
+        Sleep(LOG_DRAIN_INTERVAL_MS);
+    }
+
+    g_Logger.Drain(WriteLogLine, nullptr);
+
+    if (g_pLogFile != nullptr)
+    {
+        fclose(g_pLogFile);
+        g_pLogFile = nullptr;
+    }
+
+    g_LogStopped = true;
+
+    return 0;
+}
 
 // Infinitely check the current game running
 uint32_t MonitorTitleId(void *pThreadParameter)
@@ -60,6 +141,9 @@ uint32_t MonitorTitleId(void *pThreadParameter)
 
         currentTitleId = newTitleId;
 
+        if (g_IW3Loaded)
+            ReleaseIW3();
+
         switch (newTitleId)
         {
         case GAME_DASHBOARD:
@@ -71,6 +155,11 @@ uint32_t MonitorTitleId(void *pThreadParameter)
         }
     }
 
+    // The plugin is being unloaded. Threads are stopped from here because DllMain runs under
+    // the loader lock, it waits for g_MonitorStopped instead
+    ShutdownPlugin();
+    g_MonitorStopped = true;
+
     return 0;
 }
 
@@ -141,6 +230,23 @@ public:
         return reinterpret_cast<T>(&s_StubSection[m_HookIndex]);
     }
 
+    // Gives every stub back once the title the hooks were installed in is gone, the next title
+    // installs its hooks from the first stub again instead of running out after a few loads
+    static void ResetStubs()
+    {
+        if (s_CriticalSection.Synchronization.RawEvent[0] == 0)
+            InitializeCriticalSection(&s_CriticalSection);
+
+        EnterCriticalSection(&s_CriticalSection);
+
+        for (size_t i = 0; i < MAX_HOOK_COUNT; i++)
+            s_StubSection[i] = Stub();
+
+        s_HookCount = 0;
+
+        LeaveCriticalSection(&s_CriticalSection);
+    }
+
 private:
     typedef uint32_t POWERPC_INSTRUCTION;
     typedef uint8_t POWERPC_INSTRUCTION_TYPE;
@@ -254,6 +360,248 @@ Detour::Stub Detour::s_StubSection[MAX_HOOK_COUNT];
 size_t Detour::s_HookCount = 0;
 CRITICAL_SECTION Detour::s_CriticalSection = { 0 };
 
+uint64_t g_TimeBaseTicksPerMs = 0;
+
+void InitTimeBase()
+{
+    g_TimeBaseTicksPerMs = GetTimeBaseFrequency() / 1000;
+}
+
+inline uint64_t TimeBaseToUs(uint64_t ticks)
+{
+    return g_TimeBaseTicksPerMs ? ticks * 1000 / g_TimeBaseTicksPerMs : 0;
+}
+
+#define MAX_SCHEDULER_TASKS 64
+#define SCHEDULER_DEFAULT_BUDGET_US 2000
+
+enum TaskPriority
+{
+    TASK_PRIORITY_HIGH,
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_LOW,
+    TASK_PRIORITY_COUNT,
+};
+
+enum TaskResult
+{
+    TASK_DONE,       // The task finished, it's removed unless it repeats
+    TASK_YIELD,      // The task can continue this frame if there is budget left
+    TASK_NEXT_FRAME, // The task wants to continue next frame
+};
+
+struct Task;
+
+typedef TaskResult (*TaskFunction)(Task *pTask);
+
+struct Task
+{
+    const char *name;
+    TaskFunction function;
+    void *pContext;
+    int resumePoint; // Used by the TASK_* macros to resume where the task yielded
+    TaskPriority priority;
+    uint32_t repeatInterval; // In frames, 0 for one-shot tasks
+    uint32_t wakeFrame;
+    bool active;
+    uint64_t totalTicks;
+    uint64_t lastFrameTicks;
+};
+
+// Coroutine-style helpers for tasks that need more than one step. The function body goes
+// between TASK_BEGIN and TASK_END and can suspend with TASK_YIELD or TASK_WAIT_FRAME.
+// Locals aren't preserved across a suspension, anything that needs to survive one has to
+// live in the task context
+#define TASK_BEGIN(pTask) \
+    switch ((pTask)->resumePoint) \
+    { \
+    case 0:
+
+#define TASK_SUSPEND(pTask, result) \
+    do \
+    { \
+        (pTask)->resumePoint = __LINE__; \
+        return result; \
+    case __LINE__:; \
+    } while (0)
+
+#define TASK_YIELD(pTask) TASK_SUSPEND(pTask, TASK_YIELD)
+#define TASK_WAIT_FRAME(pTask) TASK_SUSPEND(pTask, TASK_NEXT_FRAME)
+
+#define TASK_END(pTask) \
+    } \
+    (pTask)->resumePoint = 0; \
+    return TASK_DONE
+
+// Runs plugin tasks from the server frame within a time budget. High priority tasks always
+// get a step every frame, the budget only limits how far into the normal and low priority
+// tasks the scheduler gets, the ones it doesn't reach are picked up first next frame
+class Scheduler
+{
+public:
+    Scheduler()
+        : m_FrameNumber(0), m_BudgetTicks(0), m_BudgetUs(SCHEDULER_DEFAULT_BUDGET_US), m_LastFrameTicks(0), m_OverBudgetFrames(0)
+    {
+        ZeroMemory(&m_Tasks, sizeof(m_Tasks));
+        ZeroMemory(&m_Cursors, sizeof(m_Cursors));
+    }
+
+    Task *AddTask(const char *name, TaskFunction function, void *pContext, TaskPriority priority, uint32_t repeatInterval = 0)
+    {
+        for (size_t i = 0; i < MAX_SCHEDULER_TASKS; i++)
+        {
+            Task *pTask = &m_Tasks[i];
+            if (pTask->active)
+                continue;
+
+            ZeroMemory(pTask, sizeof(Task));
+            pTask->name = name;
+            pTask->function = function;
+            pTask->pContext = pContext;
+            pTask->priority = priority;
+            pTask->repeatInterval = repeatInterval;
+            pTask->wakeFrame = m_FrameNumber + 1;
+            pTask->active = true;
+            return pTask;
+        }
+
+        return nullptr;
+    }
+
+    void RemoveTask(Task *pTask)
+    {
+        if (pTask != nullptr)
+            pTask->active = false;
+    }
+
+    void RemoveAllTasks()
+    {
+        for (size_t i = 0; i < MAX_SCHEDULER_TASKS; i++)
+            m_Tasks[i].active = false;
+    }
+
+    void SetBudget(uint32_t budgetUs)
+    {
+        m_BudgetUs = budgetUs;
+        m_BudgetTicks = 0;
+    }
+
+    void RunFrame()
+    {
+        uint64_t frameStart = ReadTimeBase();
+
+        if (m_BudgetTicks == 0)
+            m_BudgetTicks = m_BudgetUs * g_TimeBaseTicksPerMs / 1000;
+
+        uint64_t deadline = frameStart + m_BudgetTicks;
+        m_FrameNumber++;
+
+        for (int priority = TASK_PRIORITY_HIGH; priority < TASK_PRIORITY_COUNT; priority++)
+        {
+            size_t start = m_Cursors[priority];
+            bool outOfBudget = false;
+
+            for (size_t i = 0; i < MAX_SCHEDULER_TASKS; i++)
+            {
+                size_t index = (start + i) % MAX_SCHEDULER_TASKS;
+                Task *pTask = &m_Tasks[index];
+
+                if (!pTask->active || pTask->priority != priority || pTask->wakeFrame > m_FrameNumber)
+                    continue;
+
+                if (priority != TASK_PRIORITY_HIGH && ReadTimeBase() >= deadline)
+                {
+                    // Start from this task next frame so nothing starves
+                    m_Cursors[priority] = index;
+                    outOfBudget = true;
+                    break;
+                }
+
+                RunTask(pTask, deadline);
+            }
+
+            if (outOfBudget)
+            {
+                m_OverBudgetFrames++;
+                break;
+            }
+        }
+
+        m_LastFrameTicks = ReadTimeBase() - frameStart;
+    }
+
+    uint32_t GetFrameNumber() const { return m_FrameNumber; }
+
+    uint64_t GetLastFrameTicks() const { return m_LastFrameTicks; }
+
+    uint32_t GetOverBudgetFrames() const { return m_OverBudgetFrames; }
+
+    const Task *GetTasks() const { return m_Tasks; }
+
+private:
+    Task m_Tasks[MAX_SCHEDULER_TASKS];
+    size_t m_Cursors[TASK_PRIORITY_COUNT];
+    uint32_t m_FrameNumber;
+    uint64_t m_BudgetTicks;
+    uint32_t m_BudgetUs;
+    uint64_t m_LastFrameTicks;
+    uint32_t m_OverBudgetFrames;
+
+    void RunTask(Task *pTask, uint64_t deadline)
+    {
+        TraceSpan span(pTask->name);
+        uint64_t taskStart = ReadTimeBase();
+        TaskResult result;
+
+        // Keep stepping a yielding task while there is budget left
+        do
+            result = pTask->function(pTask);
+        while (result == TASK_YIELD && ReadTimeBase() < deadline && pTask->active);
+
+        switch (result)
+        {
+        case TASK_DONE:
+            if (pTask->repeatInterval != 0)
+                pTask->wakeFrame = m_FrameNumber + pTask->repeatInterval;
+            else
+                pTask->active = false;
+            break;
+        case TASK_YIELD:
+        case TASK_NEXT_FRAME:
+            pTask->wakeFrame = m_FrameNumber + 1;
+            break;
+        }
+
+        pTask->lastFrameTicks = ReadTimeBase() - taskStart;
+        pTask->totalTicks += pTask->lastFrameTicks;
+    }
+};
+
+Scheduler g_Scheduler;
+
+#define MAX_COMPLETIONS_PER_STEP 16
+
+// Hardware threads the pool workers are pinned to, change these if they collide with the
+// threads the game keeps busy
+const uint32_t g_PoolHardwareThreads[] = { 3, 5 };
+
+ThreadPool g_ThreadPool;
+
+// Hands the results of finished pool jobs back to the server thread
+TaskResult Task_RunPoolCompletions(Task *pTask)
+{
+    return g_ThreadPool.RunCompletions(MAX_COMPLETIONS_PER_STEP) == MAX_COMPLETIONS_PER_STEP ? TASK_YIELD : TASK_DONE;
+}
+
+void InitThreadPool()
+{
+    // ReleaseIW3 stops the pool when the title goes away so jobs never outlive it
+    g_ThreadPool.Start(g_PoolHardwareThreads, sizeof(g_PoolHardwareThreads) / sizeof(g_PoolHardwareThreads[0]));
+
+    if (g_ThreadPool.IsRunning())
+        g_Scheduler.AddTask("pool completions", Task_RunPoolCompletions, nullptr, TASK_PRIORITY_NORMAL, 1);
+}
+
 #define KEY_MASK_FIRE 1
 #define KEY_MASK_SPRINT 2
 #define KEY_MASK_MELEE 4
@@ -1038,6 +1386,16 @@ struct netchan_t
     netProfileInfo_t prof;
 };
 
+enum clientState_t : __int32
+{
+    CS_FREE = 0x0,
+    CS_ZOMBIE = 0x1,
+    CS_RECONNECTING = 0x2,
+    CS_CONNECTED = 0x3,
+    CS_CLIENTLOADING = 0x4,
+    CS_ACTIVE = 0x5,
+};
+
 /* 9758 */
 const struct clientHeader_t
 {
@@ -1184,6 +1542,57 @@ gentity_s *g_entities = reinterpret_cast<gentity_s *>(0x8287CD08);
 serverStaticHeader_t *svsHeader = reinterpret_cast<serverStaticHeader_t *>(0x849F1580);
 level_locals_t *level = reinterpret_cast<level_locals_t *>(0x82A07650);
 
+// todo: find address for Scr_AddInt. Scr_AddBool pushes its argument as an integer without
+// clamping it, the button methods already rely on that
+void Scr_AddInt(int value)
+{
+    Scr_AddBool(value);
+}
+
+// todo: find addresses for Scr_GetInt, Scr_GetFloat and Scr_GetVector. Until then they parse
+// the text Scr_GetString casts numbers and vectors to. That cast formats floats with %g, so
+// floats and vector components only keep 6 significant digits. Text that isn't entirely a
+// number is a type error like it is with the engine's getters, not 0
+int Scr_GetInt(unsigned int index)
+{
+    const char *value = Scr_GetString(index);
+    char *end = nullptr;
+    long number = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0')
+    {
+        Scr_ObjectError("expected an integer\n");
+        return 0;
+    }
+
+    return static_cast<int>(number);
+}
+
+float Scr_GetFloat(unsigned int index)
+{
+    const char *value = Scr_GetString(index);
+    char *end = nullptr;
+    double number = strtod(value, &end);
+
+    if (end == value || *end != '\0')
+    {
+        Scr_ObjectError("expected a float\n");
+        return 0.0f;
+    }
+
+    return static_cast<float>(number);
+}
+
+void Scr_GetVector(unsigned int index, float *vector)
+{
+    const char *value = Scr_GetString(index);
+    char trailing = '\0';
+
+    vector[0] = vector[1] = vector[2] = 0.0f;
+    if (sscanf_s(value, " ( %f , %f , %f ) %c", &vector[0], &vector[1], &vector[2], &trailing, 1) != 3)
+        Scr_ObjectError("expected a vector\n");
+}
+
 client_t *GetClientAtIndex(int index)
 {
     size_t clientSize = 666760;
@@ -1192,6 +1601,12 @@ client_t *GetClientAtIndex(int index)
     return clientAtIndex;
 }
 
+// The host of a listen server is connected over loopback, every other player over the network
+bool IsHostClient(int clientNum)
+{
+    return GetClientAtIndex(clientNum)->header.netchan.remoteAddress.type == NA_LOOPBACK;
+}
+
 gclient_s *GetGclientAtIndex(int index)
 {
     size_t clientSize = 12724;
@@ -1200,8 +1615,42 @@ gclient_s *GetGclientAtIndex(int index)
     return clientAtIndex;
 }
 
+// The engine's gentity_s is larger than the part declared above, entities are always indexed
+// with its real stride instead of g_entities[index] or ent - g_entities
+gentity_s *GetEntityAtIndex(int index)
+{
+    return reinterpret_cast<gentity_s *>(reinterpret_cast<unsigned char *>(level->gentities) + index * level->gentitySize);
+}
+
+int GetEntityNumber(const gentity_s *ent)
+{
+    return static_cast<int>((reinterpret_cast<const unsigned char *>(ent) - reinterpret_cast<const unsigned char *>(level->gentities)) / level->gentitySize);
+}
+
+// Print a message on the client's screen, used for the output of plugin console commands
+void PrintToClient(int clientNum, const char *format, ...)
+{
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    _vsnprintf_s(message, _TRUNCATE, format, args);
+    va_end(args);
+
+    // The message is sent quoted so it can't contain quotes itself
+    for (char *cursor = message; *cursor != '\0'; cursor++)
+    {
+        if (*cursor == '"')
+            *cursor = '\'';
+    }
+
+    char command[1040];
+    _snprintf_s(command, _TRUNCATE, "e \"%s\"", message);
+    SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, command);
+}
+
 void GScr_ExecuteClientCommand(scr_entref_t entref)
 {
+    TRACE_SPAN("executeclientcommand");
     gentity_s *ent = GetEntity(entref);
 
     // todo: find address for Scr_GetNumParam
@@ -1217,151 +1666,4377 @@ void GScr_ExecuteClientCommand(scr_entref_t entref)
 
     // TODO: this works but it needs special formatting for a client command?
     // SV_ExecuteClientCommand(reinterpret_cast<client_t*>(0xB112AD68), cmd, 1);
-    int clientNum = ent - g_entities;
+    int clientNum = GetEntityNumber(ent);
     Cbuf_AddText(clientNum, cmd);
 }
 
-void Cmd_AddCommand(const char *name)
+#define PLUGIN_ARENA_SIZE (16 * 1024)
+#define FRAME_ARENA_SIZE (32 * 1024)
+#define MAX_PLUGIN_COMMANDS 32
+#define MAX_PLUGIN_DETOURS 16
+
+// Everything the plugin allocates comes from these blocks instead of the title heap the game
+// also uses. Long lived objects are carved out of the plugin arena once, the frame arena is
+// scratch memory that's reset at the start of every server frame
+CACHE_ALIGN uint8_t g_PluginArenaMemory[PLUGIN_ARENA_SIZE];
+CACHE_ALIGN uint8_t g_FrameArenaMemory[FRAME_ARENA_SIZE];
+Arena g_PluginArena(g_PluginArenaMemory, sizeof(g_PluginArenaMemory));
+Arena g_FrameArena(g_FrameArenaMemory, sizeof(g_FrameArenaMemory));
+ObjectPool<Detour> g_DetourPool;
+ObjectPool<cmd_function_s> g_CommandPool;
+
+typedef void (*PluginCommandFunction)(gentity_s *ent);
+
+struct PluginCommand
 {
-    cmd_function_s *cmd = new cmd_function_s;
-    cmd->name = name;
-    cmd->autoCompleteDir = nullptr;
-    cmd->autoCompleteExt = nullptr;
-    cmd->function = 0;   // Handled in ClientCommandHook since we need to pass gentity_s
-    cmd->next = nullptr; // Since it's the last item, next should be null
+    uint32_t hash;
+    size_t nameLength;
+    const char *name;
+    PluginCommandFunction function;
+};
 
-    // Traverse the list to find the last element
-    cmd_function_s *current = cmd_functions;
-    while (current->next != nullptr)
-        current = current->next;
+#define PLUGIN_COMMAND_SLOTS (MAX_PLUGIN_COMMANDS * 2) // Power of 2
 
-    current->next = cmd;
+// Open addressed table of indices into g_PluginCommands plus 1, 0 for empty slots, so
+// ClientCommandHook finds the plugin command a client sent without comparing every name
+PluginCommand g_PluginCommands[MAX_PLUGIN_COMMANDS];
+uint8_t g_PluginCommandSlots[PLUGIN_COMMAND_SLOTS];
+size_t g_PluginCommandCount = 0;
+
+// Last node the plugin appended. The engine never removes the plugin's commands so the next
+// one can be appended from here without walking the list again
+cmd_function_s *g_pCommandTail = nullptr;
+
+void InitPluginMemory()
+{
+    g_PluginArena.Reset();
+    g_FrameArena.Reset();
+    g_DetourPool.Init(&g_PluginArena, MAX_PLUGIN_DETOURS);
+    g_CommandPool.Init(&g_PluginArena, MAX_PLUGIN_COMMANDS);
 }
 
-void Cmd_Noclip_f(gentity_s *ent)
+Detour *CreateDetour(uintptr_t sourceAddress, const void *pDestination)
 {
-    int current = ent->client->noclip;
-    ent->client->noclip = current == 0;
-    int clientNum = ent - g_entities;
-    if (current)
-        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_NOCLIPOFF\"");
-    else
-        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_NOCLIPON\"");
+    void *pMemory = g_DetourPool.AllocateRaw();
+    return pMemory != nullptr ? new (pMemory) Detour(sourceAddress, pDestination) : nullptr;
 }
 
-void Cmd_UFO_f(gentity_s *ent)
+// Removes the hook and gives the memory back to the pool
+void DestroyDetour(Detour *pDetour)
 {
-    int current = ent->client->ufo;
-    ent->client->ufo = current == 0;
-    int clientNum = ent - g_entities;
-    if (current)
-        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_UFOOFF\"");
-    else
-        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_UFOON\"");
+    g_DetourPool.Free(pDetour);
 }
 
-void GScr_testfunction(scr_entref_t entref)
+// Takes the plugin's commands out of the engine's list, their memory goes away with the plugin
+void Cmd_RemoveCommands()
 {
-    // client_t *cl = GetClientAtIndex(entref.entnum);
-    // std::cout << "scr_entref_t address: " << entref << std::endl;
-    // gentity_s *gent = GetEntity(entref);
+    cmd_function_s *previous = cmd_functions;
+    while (previous->next != nullptr)
+    {
+        cmd_function_s *current = previous->next;
+        if (!g_CommandPool.Owns(current))
+        {
+            previous = current;
+            continue;
+        }
+
+        previous->next = current->next;
+        g_CommandPool.Free(current);
+    }
 
-    std::cout << "Size of playerState_s: " << sizeof(playerState_s) << " bytes" << std::endl;
-    std::cout << "Size of clientSession_t: " << sizeof(clientSession_t) << " bytes" << std::endl;
-    std::cout << "Size of client_t: " << sizeof(client_t) << " bytes" << std::endl;
+    g_pCommandTail = nullptr;
+    g_PluginCommandCount = 0;
+    memset(g_PluginCommandSlots, 0, sizeof(g_PluginCommandSlots));
 }
 
-void PlayerCmd_JumpButtonPressed(scr_entref_t entref)
+void Cmd_MemoryStats_f(gentity_s *ent)
 {
-    // if (Scr_GetNumParam())
-    //     Scr_Error("Usage: <client> JumpButtonPressed()\n");
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "memory: plugin arena %u/%u bytes, frame arena peak %u/%u bytes, %u failures",
+        static_cast<uint32_t>(g_PluginArena.GetUsedBytes()),
+        static_cast<uint32_t>(g_PluginArena.GetCapacity()),
+        static_cast<uint32_t>(g_FrameArena.GetPeakBytes()),
+        static_cast<uint32_t>(g_FrameArena.GetCapacity()),
+        g_PluginArena.GetFailureCount() + g_FrameArena.GetFailureCount()
+    );
 
-    client_t *cl = GetClientAtIndex(entref.entnum);
+    PrintToClient(
+        clientNum,
+        "  detours %u live (peak %u of %u), commands %u live (peak %u of %u)",
+        static_cast<uint32_t>(g_DetourPool.GetLiveCount()),
+        static_cast<uint32_t>(g_DetourPool.GetPeakCount()),
+        static_cast<uint32_t>(g_DetourPool.GetCapacity()),
+        static_cast<uint32_t>(g_CommandPool.GetLiveCount()),
+        static_cast<uint32_t>(g_CommandPool.GetPeakCount()),
+        static_cast<uint32_t>(g_CommandPool.GetCapacity())
+    );
+}
 
-    if (!cl)
-        Scr_ObjectError("not a client\n");
+#define MAX_BATCHED_COMMANDS_LENGTH 4096
+#define MAX_DVARS_PER_BATCH 16
 
-    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_JUMP);
-}
+#define COMMAND_INDEX_SLOTS 2048 // Power of 2, about twice the number of engine commands
+#define COMMAND_INDEX_NAMES_SIZE (16 * 1024)
 
-void PlayerCmd_HoldBreathButtonPressed(scr_entref_t entref)
+struct CommandIndexEntry
 {
-    // if (Scr_GetNumParam())
-    //     Scr_Error("Usage: <client> HoldBreathButtonPressed()\n");
+    uint32_t hash; // 0 for empty slots
+    uint16_t nameOffset;
+    uint16_t nameLength;
+};
 
-    client_t *cl = GetClientAtIndex(entref.entnum);
+struct CommandIndexStats
+{
+    uint32_t rebuilds;
+    uint32_t lookups;
+    uint32_t probes;
+    uint32_t overflows;
+};
 
-    if (!cl)
-        Scr_ObjectError("not a client\n");
+// Hash set of the names in cmd_functions so checking if a command exists doesn't walk the
+// whole list. Names are copied since the engine can remove and free its commands.
+// The engine adds its commands at the front of the list, so the index is rebuilt when a lookup
+// sees the first command changed, and on level changes. The plugin's commands are appended at
+// the end and indexed as they're added. A command the engine removed from the middle of the
+// list stays indexed until the next rebuild, which only sends it through the command buffer
+CommandIndexEntry g_CommandIndex[COMMAND_INDEX_SLOTS];
+char g_CommandIndexNames[COMMAND_INDEX_NAMES_SIZE];
+size_t g_CommandIndexNamesUsed = 0;
+uint32_t g_CommandIndexCount = 0;
+cmd_function_s *g_pCommandIndexHead = nullptr;
+CommandIndexStats g_CommandIndexStats;
+
+// FNV-1a over the lowercase name, the engine compares command names and userinfo keys case
+// insensitively
+uint32_t HashNameNoCase(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ static_cast<uint8_t>(tolower(static_cast<unsigned char>(name[i])))) * 16777619u;
 
-    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_HOLDBREATH);
+    return hash != 0 ? hash : 1;
 }
 
-void PlayerCmd_LeanLeftButtonPressed(scr_entref_t entref)
+// Returns the slot holding the name, or the empty slot it would go in
+CommandIndexEntry *FindCommandIndexSlot(const char *name, size_t length, uint32_t hash)
 {
-    // if (Scr_GetNumParam())
-    //     Scr_Error("Usage: <client> LeanLeftButtonPressed()\n");
+    size_t slot = hash & (COMMAND_INDEX_SLOTS - 1);
 
-    client_t *cl = GetClientAtIndex(entref.entnum);
+    for (;;)
+    {
+        CommandIndexEntry *pEntry = &g_CommandIndex[slot];
+        g_CommandIndexStats.probes++;
 
-    if (!cl)
-        Scr_ObjectError("not a client\n");
+        if (pEntry->hash == 0)
+            return pEntry;
 
-    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_LEANLEFT);
+        if (pEntry->hash == hash && pEntry->nameLength == length && I_strnicmp(&g_CommandIndexNames[pEntry->nameOffset], name, length) == 0)
+            return pEntry;
+
+        slot = (slot + 1) & (COMMAND_INDEX_SLOTS - 1);
+    }
 }
 
-void PlayerCmd_LeanRightButtonPressed(scr_entref_t entref)
+void IndexCommandName(const char *name)
 {
-    // if (Scr_GetNumParam())
-    //     Scr_Error("Usage: <client> LeanRightButtonPressed()\n");
+    size_t length = strlen(name);
+    uint32_t hash = HashNameNoCase(name, length);
 
-    client_t *cl = GetClientAtIndex(entref.entnum);
+    CommandIndexEntry *pEntry = FindCommandIndexSlot(name, length, hash);
+    if (pEntry->hash != 0)
+        return;
 
-    if (!cl)
-        Scr_ObjectError("not a client\n");
+    // Keep the table at most half full so probes stay short
+    if (g_CommandIndexCount >= COMMAND_INDEX_SLOTS / 2 || g_CommandIndexNamesUsed + length + 1 > COMMAND_INDEX_NAMES_SIZE)
+    {
+        g_CommandIndexStats.overflows++;
+        return;
+    }
 
-    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_LEANRIGHT);
+    memcpy(&g_CommandIndexNames[g_CommandIndexNamesUsed], name, length + 1);
+    pEntry->hash = hash;
+    pEntry->nameOffset = static_cast<uint16_t>(g_CommandIndexNamesUsed);
+    pEntry->nameLength = static_cast<uint16_t>(length);
+
+    g_CommandIndexNamesUsed += length + 1;
+    g_CommandIndexCount++;
 }
 
-void GScr_CloneBrushModelToScriptModel(scr_entref_t entref)
+void RebuildCommandIndex()
 {
-    // // Common checks.
-    // if (Scr_GetNumParam() != 1)
-    //     Scr_Error("usage: <scriptModelEnt> CloneBrushModelToScriptModel(<brushModelEnt>)");
+    memset(g_CommandIndex, 0, sizeof(g_CommandIndex));
+    g_CommandIndexNamesUsed = 0;
+    g_CommandIndexCount = 0;
+    g_CommandIndexStats.overflows = 0;
 
-    // // Object checks.
+    // cmd_functions is the list head, the first command is the one it points to
+    for (cmd_function_s *cmd = cmd_functions->next; cmd != nullptr; cmd = cmd->next)
+    {
+        if (cmd->name != nullptr)
+            IndexCommandName(cmd->name);
+    }
+
+    g_pCommandIndexHead = cmd_functions->next;
+    g_CommandIndexStats.rebuilds++;
+}
+
+void Cmd_CommandIndex_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "commandindex: %u commands, %u lookups, %u probes, %u rebuilds, %u names didn't fit",
+        g_CommandIndexCount,
+        g_CommandIndexStats.lookups,
+        g_CommandIndexStats.probes,
+        g_CommandIndexStats.rebuilds,
+        g_CommandIndexStats.overflows
+    );
+}
+
+// todo: find addresses for Cmd_FindCommand, Cmd_AddCommand and Cmd_RemoveCommand. The engine's
+// own lookups, and so everything going through Cbuf_AddText, still walk cmd_functions, only
+// the plugin's lookups use the index. Hooking the add and remove functions would also catch
+// commands removed from the middle of the list
+
+// Check if the name of length nameLength is a registered console command
+bool Cmd_Exists(const char *name, size_t nameLength)
+{
+    if (cmd_functions->next != g_pCommandIndexHead)
+        RebuildCommandIndex();
+
+    g_CommandIndexStats.lookups++;
+    return FindCommandIndexSlot(name, nameLength, HashNameNoCase(name, nameLength))->hash != 0;
+}
+
+// Check if the command is a plain "<dvar> <value>" assignment and split it in place.
+// Only simple names that aren't commands and unquoted or fully quoted values are accepted
+bool ParseDvarAssignment(char *command, const char **pName, const char **pValue)
+{
+    char *name = command;
+    char *cursor = command;
+
+    while (isalnum(static_cast<unsigned char>(*cursor)) || *cursor == '_')
+        cursor++;
+
+    if (cursor == name || (*cursor != ' ' && *cursor != '\t'))
+        return false;
+
+    char *nameEnd = cursor;
+    while (*cursor == ' ' || *cursor == '\t')
+        cursor++;
+
+    char *value = cursor;
+    size_t valueLength = strlen(value);
+    bool quoted = valueLength >= 2 && value[0] == '"' && value[valueLength - 1] == '"';
+    if (quoted)
+    {
+        value++;
+        valueLength -= 2;
+    }
+
+    if (valueLength == 0 || memchr(value, '"', valueLength) != nullptr)
+        return false;
+
+    if (Cmd_Exists(name, nameEnd - name))
+        return false;
+
+    *nameEnd = '\0';
+    value[valueLength] = '\0';
+
+    *pName = name;
+    *pValue = value;
+    return true;
+}
+
+// Returns the next command of a ';' or newline separated list and moves past it, or nullptr
+// at the end. Separators inside quotes don't count, like in the command buffer
+char *NextBatchedCommand(char **pCursor)
+{
+    char *cursor = *pCursor;
+
+    while (*cursor != '\0')
+    {
+        char *command = cursor;
+        bool quoted = false;
+        while (*cursor != '\0' && (quoted || (*cursor != ';' && *cursor != '\n')))
+        {
+            if (*cursor == '"')
+                quoted = !quoted;
+            cursor++;
+        }
+
+        if (*cursor != '\0')
+            *cursor++ = '\0';
+
+        while (*command == ' ' || *command == '\t')
+            command++;
+
+        if (*command != '\0')
+        {
+            *pCursor = cursor;
+            return command;
+        }
+    }
+
+    *pCursor = cursor;
+    return nullptr;
+}
+
+// Every command goes through the command buffer like with executeclientcommand, they're only
+// added to it at once
+void GScr_ExecuteClientCommands(scr_entref_t entref)
+{
+    TRACE_SPAN("executeclientcommands");
+    gentity_s *ent = GetEntity(entref);
+    int clientNum = GetEntityNumber(ent);
+
+    // The buffers are frame scratch so they don't take 8 KB of stack
+    size_t scratchPosition = g_FrameArena.GetPosition();
+    char *commands = g_FrameArena.AllocateArray<char>(MAX_BATCHED_COMMANDS_LENGTH);
+    char *text = g_FrameArena.AllocateArray<char>(MAX_BATCHED_COMMANDS_LENGTH);
+    if (commands == nullptr || text == nullptr)
+    {
+        g_FrameArena.Rewind(scratchPosition);
+        Scr_ObjectError("executeclientcommands: out of scratch memory\n");
+        return;
+    }
+
+    strncpy_s(commands, MAX_BATCHED_COMMANDS_LENGTH, Scr_GetString(0), _TRUNCATE);
+
+    size_t textLength = 0;
+    char *cursor = commands;
+    for (char *command = NextBatchedCommand(&cursor); command != nullptr; command = NextBatchedCommand(&cursor))
+    {
+        size_t commandLength = strlen(command);
+        if (textLength + commandLength + 2 > MAX_BATCHED_COMMANDS_LENGTH)
+        {
+            g_FrameArena.Rewind(scratchPosition);
+            Scr_ObjectError("executeclientcommands: commands are too long\n");
+            return;
+        }
+
+        memcpy(&text[textLength], command, commandLength);
+        textLength += commandLength;
+        text[textLength++] = '\n';
+    }
+
+    if (textLength != 0)
+    {
+        text[textLength] = '\0';
+        Cbuf_AddText(clientNum, text);
+    }
+
+    g_FrameArena.Rewind(scratchPosition);
+}
+
+// Sets client dvars from "<dvar> <value>" assignments, sent straight to the client the same
+// way setclientdvar does it so they skip the command buffer and its tokenizer entirely. The
+// whole list is checked before anything is sent, an entry that isn't a plain assignment or
+// names a console command is a script error and nothing is set
+void GScr_SetClientDvars(scr_entref_t entref)
+{
+    TRACE_SPAN("setclientdvars");
+    gentity_s *ent = GetEntity(entref);
+    int clientNum = GetEntityNumber(ent);
+
+    size_t scratchPosition = g_FrameArena.GetPosition();
+    char *commands = g_FrameArena.AllocateArray<char>(MAX_BATCHED_COMMANDS_LENGTH);
+    char *serverCommand = g_FrameArena.AllocateArray<char>(MAX_BATCHED_COMMANDS_LENGTH);
+    if (commands == nullptr || serverCommand == nullptr)
+    {
+        g_FrameArena.Rewind(scratchPosition);
+        Scr_ObjectError("setclientdvars: out of scratch memory\n");
+        return;
+    }
+
+    strncpy_s(commands, MAX_BATCHED_COMMANDS_LENGTH, Scr_GetString(0), _TRUNCATE);
+
+    const char *names[MAX_DVARS_PER_BATCH];
+    const char *values[MAX_DVARS_PER_BATCH];
+    int dvarCount = 0;
+
+    char *cursor = commands;
+    for (char *command = NextBatchedCommand(&cursor); command != nullptr; command = NextBatchedCommand(&cursor))
+    {
+        if (dvarCount == MAX_DVARS_PER_BATCH)
+        {
+            g_FrameArena.Rewind(scratchPosition);
+            Scr_ObjectError("setclientdvars: too many dvars\n");
+            return;
+        }
+
+        if (!ParseDvarAssignment(command, &names[dvarCount], &values[dvarCount]))
+        {
+            g_FrameArena.Rewind(scratchPosition);
+            Scr_ObjectError("setclientdvars: expected \"<dvar> <value>\" assignments only\n");
+            return;
+        }
+
+        dvarCount++;
+    }
+
+    for (int i = 0; i < dvarCount; i++)
+    {
+        _snprintf_s(serverCommand, MAX_BATCHED_COMMANDS_LENGTH, _TRUNCATE, "v %s \"%s\"", names[i], values[i]);
+        SV_GameSendServerCommand(clientNum, SV_CMD_RELIABLE, serverCommand);
+    }
+
+    g_FrameArena.Rewind(scratchPosition);
+}
+
+void Cmd_AddCommand(const char *name, PluginCommandFunction function)
+{
+    if (g_PluginCommandCount == MAX_PLUGIN_COMMANDS)
+        return;
+
+    cmd_function_s *cmd = g_CommandPool.Allocate();
+    if (cmd == nullptr)
+        return;
+
+    cmd->name = name;
+    cmd->autoCompleteDir = nullptr;
+    cmd->autoCompleteExt = nullptr;
+    cmd->function = 0;   // Handled in ClientCommandHook since we need to pass gentity_s
+    cmd->next = nullptr; // Since it's the last item, next should be null
+
+    // Only the first command walks the list to find the last element, commands the engine
+    // added since are also skipped over
+    cmd_function_s *current = g_pCommandTail != nullptr ? g_pCommandTail : cmd_functions;
+    while (current->next != nullptr)
+        current = current->next;
+
+    current->next = cmd;
+    g_pCommandTail = cmd;
+
+    PluginCommand *pCommand = &g_PluginCommands[g_PluginCommandCount++];
+    pCommand->nameLength = strlen(name);
+    pCommand->hash = HashNameNoCase(name, pCommand->nameLength);
+    pCommand->name = name;
+    pCommand->function = function;
+
+    // The table is never more than half full, there always is an empty slot to stop at
+    size_t slot = pCommand->hash & (PLUGIN_COMMAND_SLOTS - 1);
+    while (g_PluginCommandSlots[slot] != 0)
+        slot = (slot + 1) & (PLUGIN_COMMAND_SLOTS - 1);
+
+    g_PluginCommandSlots[slot] = static_cast<uint8_t>(g_PluginCommandCount);
+
+    IndexCommandName(name);
+}
+
+// Returns the plugin command with exactly this name, compared case insensitively, or nullptr
+const PluginCommand *Cmd_FindPluginCommand(const char *name)
+{
+    size_t nameLength = strlen(name);
+    uint32_t hash = HashNameNoCase(name, nameLength);
+
+    for (size_t slot = hash & (PLUGIN_COMMAND_SLOTS - 1); g_PluginCommandSlots[slot] != 0; slot = (slot + 1) & (PLUGIN_COMMAND_SLOTS - 1))
+    {
+        const PluginCommand *pCommand = &g_PluginCommands[g_PluginCommandSlots[slot] - 1];
+        if (pCommand->hash == hash && pCommand->nameLength == nameLength && I_strnicmp(pCommand->name, name, nameLength) == 0)
+            return pCommand;
+    }
+
+    return nullptr;
+}
+
+void Cmd_Noclip_f(gentity_s *ent)
+{
+    int current = ent->client->noclip;
+    ent->client->noclip = current == 0;
+    int clientNum = GetEntityNumber(ent);
+    if (current)
+        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_NOCLIPOFF\"");
+    else
+        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_NOCLIPON\"");
+}
+
+void Cmd_UFO_f(gentity_s *ent)
+{
+    int current = ent->client->ufo;
+    ent->client->ufo = current == 0;
+    int clientNum = GetEntityNumber(ent);
+    if (current)
+        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_UFOOFF\"");
+    else
+        SV_GameSendServerCommand(clientNum, SV_CMD_CAN_IGNORE, "e \"GAME_UFOON\"");
+}
+
+void GScr_testfunction(scr_entref_t entref)
+{
+    // client_t *cl = GetClientAtIndex(entref.entnum);
+    LOG_DEBUG("scr_entref_t entnum: %u classnum: %u", entref.entnum, entref.classnum);
+    // gentity_s *gent = GetEntity(entref);
+
+    LOG_INFO("Size of playerState_s: %u bytes", sizeof(playerState_s));
+    LOG_INFO("Size of clientSession_t: %u bytes", sizeof(clientSession_t));
+    LOG_INFO("Size of client_t: %u bytes", sizeof(client_t));
+}
+
+void PlayerCmd_JumpButtonPressed(scr_entref_t entref)
+{
+    // if (Scr_GetNumParam())
+    //     Scr_Error("Usage: <client> JumpButtonPressed()\n");
+
+    client_t *cl = GetClientAtIndex(entref.entnum);
+
+    if (!cl)
+        Scr_ObjectError("not a client\n");
+
+    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_JUMP);
+}
+
+void PlayerCmd_HoldBreathButtonPressed(scr_entref_t entref)
+{
+    // if (Scr_GetNumParam())
+    //     Scr_Error("Usage: <client> HoldBreathButtonPressed()\n");
+
+    client_t *cl = GetClientAtIndex(entref.entnum);
+
+    if (!cl)
+        Scr_ObjectError("not a client\n");
+
+    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_HOLDBREATH);
+}
+
+void PlayerCmd_LeanLeftButtonPressed(scr_entref_t entref)
+{
+    // if (Scr_GetNumParam())
+    //     Scr_Error("Usage: <client> LeanLeftButtonPressed()\n");
+
+    client_t *cl = GetClientAtIndex(entref.entnum);
+
+    if (!cl)
+        Scr_ObjectError("not a client\n");
+
+    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_LEANLEFT);
+}
+
+void PlayerCmd_LeanRightButtonPressed(scr_entref_t entref)
+{
+    // if (Scr_GetNumParam())
+    //     Scr_Error("Usage: <client> LeanRightButtonPressed()\n");
+
+    client_t *cl = GetClientAtIndex(entref.entnum);
+
+    if (!cl)
+        Scr_ObjectError("not a client\n");
+
+    Scr_AddBool(cl->lastUsercmd.buttons & KEY_MASK_LEANRIGHT);
+}
+
+void GScr_CloneBrushModelToScriptModel(scr_entref_t entref)
+{
+    // // Common checks.
+    // if (Scr_GetNumParam() != 1)
+    //     Scr_Error("usage: <scriptModelEnt> CloneBrushModelToScriptModel(<brushModelEnt>)");
+
+    // // Object checks.
     // gentity_t* scriptEnt = VM_GetGEntityForNum(scriptModelEntNum);
     // if (scriptEnt->classname != (unsigned short)scr_const.script_model)
     //     Scr_ObjectError("passed entity is not a script_model entity");
 
-    // if (scriptEnt->s.eType != 6)
-    //     Scr_ObjectError("passed entity type is not 6 (TODO: what is it?)");
+    // if (scriptEnt->s.eType != 6)
+    //     Scr_ObjectError("passed entity type is not 6 (TODO: what is it?)");
+
+    // // Arguments checks.
+    // gentity_t* brushEnt = Scr_GetEntity(0);
+    // if (brushEnt->classname != (unsigned short)scr_const.script_brushmodel && brushEnt->classname != (unsigned short)scr_const.script_model && brushEnt->classname != (unsigned short)scr_const.script_origin && brushEnt->classname != (unsigned short)scr_const.light)
+    //     Scr_ParamError(0, "brush model entity classname must be one of {script_brushmodel, script_model, script_origin, light}");
+
+    // if (!brushEnt->s.index)
+    //     Scr_ParamError(0, "brush model entity has no collision model");
+
+    gentity_s *scriptEnt = GetEntity(entref);
+    gentity_s *brushEnt = Scr_GetEntity(0);
+
+    // mp_backlot scriptEntIndex: 8 == cube
+
+    SV_UnlinkEntity(scriptEnt);
+    scriptEnt->s.index = brushEnt->s.index;
+    int contents = scriptEnt->r.contents;
+    SV_SetBrushModel(scriptEnt);
+    scriptEnt->r.contents |= contents;
+    SV_LinkEntity(scriptEnt);
+}
+
+#define MAX_GENTITIES 1024
+#define ENTITY_STATE_WORDS (sizeof(entityState_s) / sizeof(uint32_t))
+#define ENTITY_STATE_CHUNKS (sizeof(entityState_s) / 16)
+#define ENTITY_DIFF_BUDGET_US 500
+
+enum EntityChange
+{
+    ENTITY_CHANGE_POSITION = 1 << 0, // lerp.pos
+    ENTITY_CHANGE_ANGLES = 1 << 1,   // lerp.apos
+    ENTITY_CHANGE_EVENTS = 1 << 2,   // eventParm, eventSequence, events, eventParms
+    ENTITY_CHANGE_WEAPON = 1 << 3,   // weapon, weaponModel
+    ENTITY_CHANGE_MODEL = 1 << 4,    // eType, index, solid
+    ENTITY_CHANGE_FLAGS = 1 << 5,    // lerp.eFlags
+    ENTITY_CHANGE_ANIM = 1 << 6,     // legsAnim, torsoAnim, torso and waist pitch
+    ENTITY_CHANGE_OTHER = 1 << 7,    // Everything else
+    ENTITY_CHANGE_INUSE = 1 << 8,    // The entity was spawned or freed
+    ENTITY_CHANGE_ALL = 0x1FF,
+};
+
+// Copy of every entity's state from the previous pass. The state is 0xF4 bytes, so only
+// every fourth entry starts on a 16 byte boundary and the compares use unaligned loads on
+// both sides
+CACHE_ALIGN entityState_s g_EntityShadow[MAX_GENTITIES];
+bool g_EntityShadowInUse[MAX_GENTITIES];
+
+uint16_t g_EntityStateWordGroups[ENTITY_STATE_WORDS];
+uint32_t g_DirtyEntities[MAX_GENTITIES / 32];
+uint16_t g_EntityChanges[MAX_GENTITIES];
+uint16_t g_DirtyEntityList[MAX_GENTITIES];
+size_t g_DirtyEntityCount = 0;
+
+struct EntityDiffStats
+{
+    uint64_t lastTicks;
+    uint64_t maxTicks;
+    uint64_t totalTicks;
+    uint32_t passes;
+    uint32_t overBudgetPasses;
+};
+
+EntityDiffStats g_EntityDiffStats;
+
+void SetEntityStateGroup(size_t offset, size_t size, uint16_t group)
+{
+    for (size_t word = offset / sizeof(uint32_t); word < (offset + size) / sizeof(uint32_t); word++)
+        g_EntityStateWordGroups[word] = group;
+}
+
+// A shadow left from the previous level would be diffed against an unrelated entity
+void ResetEntityDiff()
+{
+    memset(g_EntityShadowInUse, 0, sizeof(g_EntityShadowInUse));
+    memset(&g_EntityDiffStats, 0, sizeof(g_EntityDiffStats));
+}
+
+// Map every 32-bit word of entityState_s to the change group it belongs to
+void InitEntityDiff()
+{
+    SetEntityStateGroup(0, sizeof(entityState_s), ENTITY_CHANGE_OTHER);
+    SetEntityStateGroup(offsetof(entityState_s, eType), sizeof(int), ENTITY_CHANGE_MODEL);
+    SetEntityStateGroup(offsetof(entityState_s, lerp) + offsetof(LerpEntityState, eFlags), sizeof(int), ENTITY_CHANGE_FLAGS);
+    SetEntityStateGroup(offsetof(entityState_s, lerp) + offsetof(LerpEntityState, pos), sizeof(trajectory_t), ENTITY_CHANGE_POSITION);
+    SetEntityStateGroup(offsetof(entityState_s, lerp) + offsetof(LerpEntityState, apos), sizeof(trajectory_t), ENTITY_CHANGE_ANGLES);
+    SetEntityStateGroup(offsetof(entityState_s, index), sizeof(int), ENTITY_CHANGE_MODEL);
+    SetEntityStateGroup(offsetof(entityState_s, solid), sizeof(int), ENTITY_CHANGE_MODEL);
+    SetEntityStateGroup(offsetof(entityState_s, eventParm), offsetof(entityState_s, weapon) - offsetof(entityState_s, eventParm), ENTITY_CHANGE_EVENTS);
+    SetEntityStateGroup(offsetof(entityState_s, weapon), 2 * sizeof(int), ENTITY_CHANGE_WEAPON);
+    SetEntityStateGroup(offsetof(entityState_s, legsAnim), 2 * sizeof(int), ENTITY_CHANGE_ANIM);
+    SetEntityStateGroup(offsetof(entityState_s, fTorsoPitch), 2 * sizeof(int), ENTITY_CHANGE_ANIM);
+
+    ResetEntityDiff();
+}
+
+// Compare the state against its shadow 16 bytes at a time and only look at the words of
+// the chunks that differ to find out which groups changed
+uint16_t DiffEntityState(const entityState_s *pState, const entityState_s *pShadow)
+{
+    const uint32_t *pWords = reinterpret_cast<const uint32_t *>(pState);
+    const uint32_t *pShadowWords = reinterpret_cast<const uint32_t *>(pShadow);
+    uint16_t changes = 0;
+
+    for (size_t chunk = 0; chunk < ENTITY_STATE_CHUNKS; chunk++)
+    {
+        size_t word = chunk * 4;
+        if (Simd_Equal16(&pWords[word], &pShadowWords[word]))
+            continue;
+
+        for (size_t i = word; i < word + 4; i++)
+        {
+            if (pWords[i] != pShadowWords[i])
+                changes |= g_EntityStateWordGroups[i];
+        }
+    }
+
+    // entityState_s isn't a multiple of 16 bytes, compare what's left one word at a time
+    for (size_t i = ENTITY_STATE_CHUNKS * 4; i < ENTITY_STATE_WORDS; i++)
+    {
+        if (pWords[i] != pShadowWords[i])
+            changes |= g_EntityStateWordGroups[i];
+    }
+
+    return changes;
+}
+
+void MarkEntityDirty(int entityNum, uint16_t changes)
+{
+    g_DirtyEntities[entityNum >> 5] |= 1u << (entityNum & 31);
+    g_EntityChanges[entityNum] = changes;
+    g_DirtyEntityList[g_DirtyEntityCount++] = static_cast<uint16_t>(entityNum);
+}
+
+// Find which entities changed since the previous pass. The results stay valid until the
+// next pass, consumers read them through IsEntityDirty/GetEntityChanges or the dirty list
+TaskResult Task_DiffEntities(Task *pTask)
+{
+    uint64_t start = ReadTimeBase();
+
+    for (size_t i = 0; i < g_DirtyEntityCount; i++)
+        g_EntityChanges[g_DirtyEntityList[i]] = 0;
+
+    memset(g_DirtyEntities, 0, sizeof(g_DirtyEntities));
+    g_DirtyEntityCount = 0;
+
+    int entityCount = level->num_entities < MAX_GENTITIES ? level->num_entities : MAX_GENTITIES;
+
+    for (int i = 0; i < entityCount; i++)
+    {
+        gentity_s *ent = GetEntityAtIndex(i);
+        bool inUse = ent->r.inuse != 0;
+
+        if (!inUse)
+        {
+            if (g_EntityShadowInUse[i])
+            {
+                g_EntityShadowInUse[i] = false;
+                MarkEntityDirty(i, ENTITY_CHANGE_INUSE);
+            }
+            continue;
+        }
+
+        uint16_t changes = g_EntityShadowInUse[i] ? DiffEntityState(&ent->s, &g_EntityShadow[i]) : ENTITY_CHANGE_ALL;
+        if (changes == 0)
+            continue;
+
+        memcpy(&g_EntityShadow[i], &ent->s, sizeof(entityState_s));
+        g_EntityShadowInUse[i] = true;
+        MarkEntityDirty(i, changes);
+    }
+
+    uint64_t ticks = ReadTimeBase() - start;
+    g_EntityDiffStats.lastTicks = ticks;
+    g_EntityDiffStats.totalTicks += ticks;
+    g_EntityDiffStats.passes++;
+
+    if (ticks > g_EntityDiffStats.maxTicks)
+        g_EntityDiffStats.maxTicks = ticks;
+
+    if (TimeBaseToUs(ticks) > ENTITY_DIFF_BUDGET_US)
+        g_EntityDiffStats.overBudgetPasses++;
+
+    return TASK_DONE;
+}
+
+bool IsEntityDirty(int entityNum)
+{
+    return (g_DirtyEntities[entityNum >> 5] & (1u << (entityNum & 31))) != 0;
+}
+
+uint16_t GetEntityChanges(int entityNum)
+{
+    return IsEntityDirty(entityNum) ? g_EntityChanges[entityNum] : 0;
+}
+
+void GScr_GetEntityChanges(scr_entref_t entref)
+{
+    Scr_AddInt(GetEntityChanges(entref.entnum));
+}
+
+void Cmd_EntityDiff_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+    uint32_t passes = g_EntityDiffStats.passes ? g_EntityDiffStats.passes : 1;
+
+    PrintToClient(
+        clientNum,
+        "entitydiff: %u dirty, last %uus, avg %uus, max %uus, %u/%u passes over %uus",
+        g_DirtyEntityCount,
+        static_cast<uint32_t>(TimeBaseToUs(g_EntityDiffStats.lastTicks)),
+        static_cast<uint32_t>(TimeBaseToUs(g_EntityDiffStats.totalTicks / passes)),
+        static_cast<uint32_t>(TimeBaseToUs(g_EntityDiffStats.maxTicks)),
+        g_EntityDiffStats.overBudgetPasses,
+        g_EntityDiffStats.passes,
+        ENTITY_DIFF_BUDGET_US
+    );
+}
+
+#define MAX_CLIENTS 64
+#define MAX_HUDELEMS_PER_CLIENT 31
+#define MAX_NATIVE_HUDELEMS 16
+#define HUDELEM_WORDS (sizeof(hudelem_s) / sizeof(uint32_t))
+
+struct NativeHudElem
+{
+    hudelem_s desired; // What scripts last set, applied to the client once per frame
+    int priority;
+    int slot; // Slot in playerState_s::hud.current or -1 while it isn't shown
+    bool inUse;
+};
+
+struct ClientHud
+{
+    NativeHudElem elems[MAX_NATIVE_HUDELEMS];
+    hudelem_s written[MAX_HUDELEMS_PER_CLIENT]; // What was last written to each owned slot
+    uint32_t ownedSlots;
+    bool active;
+};
+
+struct HudStats
+{
+    uint32_t wordsWritten;
+    uint32_t wordsSkipped;
+    uint32_t evictions;
+    uint32_t slotsLost;
+};
+
+ClientHud g_ClientHuds[MAX_CLIENTS];
+HudStats g_HudStats;
+
+NativeHudElem *GetNativeHudElem(int clientNum, int handle)
+{
+    if (clientNum < 0 || clientNum >= MAX_CLIENTS || handle < 0 || handle >= MAX_NATIVE_HUDELEMS)
+        return nullptr;
+
+    NativeHudElem *pElem = &g_ClientHuds[clientNum].elems[handle];
+    return pElem->inUse ? pElem : nullptr;
+}
+
+// Only write the words of the slot that differ from what the element should look like
+void WriteHudElem(hudelem_s *pSlot, const hudelem_s *pDesired)
+{
+    uint32_t *pSlotWords = reinterpret_cast<uint32_t *>(pSlot);
+    const uint32_t *pDesiredWords = reinterpret_cast<const uint32_t *>(pDesired);
+
+    for (size_t word = 0; word < HUDELEM_WORDS; word += 4)
+    {
+        if (Simd_Equal16(&pSlotWords[word], &pDesiredWords[word]))
+        {
+            g_HudStats.wordsSkipped += 4;
+            continue;
+        }
+
+        for (size_t i = word; i < word + 4; i++)
+        {
+            if (pSlotWords[i] != pDesiredWords[i])
+            {
+                pSlotWords[i] = pDesiredWords[i];
+                g_HudStats.wordsWritten++;
+            }
+            else
+            {
+                g_HudStats.wordsSkipped++;
+            }
+        }
+    }
+}
+
+void ReleaseHudSlot(ClientHud *pHud, hudelem_s *pCurrent, int slot)
+{
+    pHud->ownedSlots &= ~(1u << slot);
+
+    // Leave the slot alone if it's not what we wrote there anymore
+    if (memcmp(&pCurrent[slot], &pHud->written[slot], sizeof(hudelem_s)) == 0)
+        memset(&pCurrent[slot], 0, sizeof(hudelem_s));
+}
+
+void InitNativeHuds()
+{
+    memset(g_ClientHuds, 0, sizeof(g_ClientHuds));
+    memset(&g_HudStats, 0, sizeof(g_HudStats));
+}
+
+void ResetClientHud(ClientHud *pHud, hudelem_s *pCurrent)
+{
+    for (int slot = 0; slot < MAX_HUDELEMS_PER_CLIENT; slot++)
+    {
+        if (pCurrent != nullptr && (pHud->ownedSlots & (1u << slot)))
+            ReleaseHudSlot(pHud, pCurrent, slot);
+    }
+
+    memset(pHud, 0, sizeof(ClientHud));
+}
+
+// Script hudelems are packed from slot 0 by the engine, native elements are kept at the top
+// of the array with a free slot in between. When there isn't enough room the lowest
+// priority native elements are hidden until there is
+void UpdateClientHud(ClientHud *pHud, hudelem_s *pCurrent)
+{
+    // Give up slots the engine wrote over since the last update
+    for (int slot = 0; slot < MAX_HUDELEMS_PER_CLIENT; slot++)
+    {
+        if ((pHud->ownedSlots & (1u << slot)) && memcmp(&pCurrent[slot], &pHud->written[slot], sizeof(hudelem_s)) != 0)
+        {
+            pHud->ownedSlots &= ~(1u << slot);
+            g_HudStats.slotsLost++;
+
+            for (int i = 0; i < MAX_NATIVE_HUDELEMS; i++)
+            {
+                if (pHud->elems[i].slot == slot)
+                    pHud->elems[i].slot = -1;
+            }
+        }
+    }
+
+    int highestScriptSlot = -1;
+    for (int slot = 0; slot < MAX_HUDELEMS_PER_CLIENT; slot++)
+    {
+        if (!(pHud->ownedSlots & (1u << slot)) && pCurrent[slot].type != HE_TYPE_FREE)
+            highestScriptSlot = slot;
+    }
+
+    int lowestNativeSlot = highestScriptSlot + 2;
+
+    // Order the elements by priority, the list is tiny so insertion sort is enough
+    int order[MAX_NATIVE_HUDELEMS];
+    int count = 0;
+    for (int i = 0; i < MAX_NATIVE_HUDELEMS; i++)
+    {
+        if (!pHud->elems[i].inUse)
+            continue;
+
+        int position = count++;
+        while (position > 0 && pHud->elems[order[position - 1]].priority < pHud->elems[i].priority)
+        {
+            order[position] = order[position - 1];
+            position--;
+        }
+        order[position] = i;
+    }
+
+    int capacity = MAX_HUDELEMS_PER_CLIENT - lowestNativeSlot;
+    if (capacity < 0)
+        capacity = 0;
+
+    uint32_t usedSlots = 0;
+
+    // Elements that keep showing stay in their slot so the client doesn't see them move
+    for (int i = 0; i < count; i++)
+    {
+        NativeHudElem *pElem = &pHud->elems[order[i]];
+
+        if (i >= capacity)
+        {
+            if (pElem->slot != -1)
+                g_HudStats.evictions++;
+
+            pElem->slot = -1;
+            continue;
+        }
+
+        if (pElem->slot >= lowestNativeSlot)
+            usedSlots |= 1u << pElem->slot;
+        else
+            pElem->slot = -1;
+    }
+
+    int nextSlot = MAX_HUDELEMS_PER_CLIENT - 1;
+    for (int i = 0; i < count && i < capacity; i++)
+    {
+        NativeHudElem *pElem = &pHud->elems[order[i]];
+        if (pElem->slot == -1)
+        {
+            while (usedSlots & (1u << nextSlot))
+                nextSlot--;
+
+            pElem->slot = nextSlot;
+            usedSlots |= 1u << nextSlot;
+        }
+
+        WriteHudElem(&pCurrent[pElem->slot], &pElem->desired);
+        memcpy(&pHud->written[pElem->slot], &pCurrent[pElem->slot], sizeof(hudelem_s));
+    }
+
+    for (int slot = 0; slot < MAX_HUDELEMS_PER_CLIENT; slot++)
+    {
+        if ((pHud->ownedSlots & (1u << slot)) && !(usedSlots & (1u << slot)))
+            ReleaseHudSlot(pHud, pCurrent, slot);
+    }
+
+    pHud->ownedSlots = usedSlots;
+}
+
+#define CLIENT_STORE_FAR_AWAY 1.0e18f
+#define CLIENT_BIT_WORDS (MAX_CLIENTS / 32)
+
+// Per-client plugin state kept as structure of arrays. Passes over every player read a few
+// dense arrays instead of striding through gclient_s and client_t, and every array starts on
+// its own cache line so passes that write different fields don't share lines. The engine
+// state the passes need is gathered once per frame by UpdateClientStore
+struct ClientStore
+{
+    CACHE_ALIGN uint8_t state[MAX_CLIENTS];   // clientState_t, CS_FREE for empty slots
+    CACHE_ALIGN uint8_t inGame[MAX_CLIENTS];  // Spawned into the game (sess.connected)
+    CACHE_ALIGN int8_t team[MAX_CLIENTS];     // team_t, -1 when not in game
+    CACHE_ALIGN int connectTime[MAX_CLIENTS]; // svs time the client connected at
+    CACHE_ALIGN float originX[MAX_CLIENTS];   // Far away when not in game
+    CACHE_ALIGN float originY[MAX_CLIENTS];
+    CACHE_ALIGN float originZ[MAX_CLIENTS];
+
+    // Slot bitsets, bit n of word n / 32 is client n
+    CACHE_ALIGN uint32_t connectedBits[CLIENT_BIT_WORDS];
+    uint32_t inGameBits[CLIENT_BIT_WORDS];
+    uint32_t teamBits[TEAM_NUM_TEAMS][CLIENT_BIT_WORDS]; // In game clients only
+};
+
+ClientStore g_ClientStore;
+
+// Visits the set bits of a client bitset in increasing order, isolating the lowest bit and
+// taking its index with a single cntlzw so empty slots cost nothing
+class ClientBitIterator
+{
+public:
+    explicit ClientBitIterator(const uint32_t *pBits)
+        : m_Word(0)
+    {
+        memcpy(m_Bits, pBits, sizeof(m_Bits));
+    }
+
+    // Returns the next client number or -1 when there are none left
+    int Next()
+    {
+        while (m_Word < CLIENT_BIT_WORDS)
+        {
+            uint32_t bits = m_Bits[m_Word];
+            if (bits != 0)
+            {
+                uint32_t lowest = bits & (0u - bits);
+                m_Bits[m_Word] = bits ^ lowest;
+                return (m_Word << 5) + static_cast<int>(31 - CountLeadingZeros(lowest));
+            }
+
+            m_Word++;
+        }
+
+        return -1;
+    }
+
+private:
+    uint32_t m_Bits[CLIENT_BIT_WORDS];
+    int m_Word;
+};
+
+inline bool IsClientBitSet(const uint32_t *pBits, int clientNum)
+{
+    return (pBits[clientNum >> 5] & (1u << (clientNum & 31))) != 0;
+}
+
+int CountClientBits(const uint32_t *pBits)
+{
+    int count = 0;
+    ClientBitIterator iterator(pBits);
+
+    while (iterator.Next() != -1)
+        count++;
+
+    return count;
+}
+
+void ResetClientStoreSlot(int clientNum)
+{
+    g_ClientStore.inGame[clientNum] = 0;
+    g_ClientStore.team[clientNum] = -1;
+    g_ClientStore.connectTime[clientNum] = 0;
+    g_ClientStore.originX[clientNum] = CLIENT_STORE_FAR_AWAY;
+    g_ClientStore.originY[clientNum] = CLIENT_STORE_FAR_AWAY;
+    g_ClientStore.originZ[clientNum] = CLIENT_STORE_FAR_AWAY;
+}
+
+void InitClientStore()
+{
+    memset(g_ClientStore.connectedBits, 0, sizeof(g_ClientStore.connectedBits));
+    memset(g_ClientStore.inGameBits, 0, sizeof(g_ClientStore.inGameBits));
+    memset(g_ClientStore.teamBits, 0, sizeof(g_ClientStore.teamBits));
+
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        g_ClientStore.state[i] = CS_FREE;
+        ResetClientStoreSlot(i);
+    }
+}
+
+#define LATENCY_MIN_COMMANDS 8 // Commands before the average interval is trusted to spot drops
+#define LATENCY_DROP_FACTOR_X2 5 // A gap over 2.5 times the average interval means commands were lost
+
+// Everything is in milliseconds. The command age is how far the server clock is ahead of the
+// server time the client stamped the command with, it grows with network delay. The jitter is
+// how much the interval between two commands differs from the previous one
+struct ClientLatency
+{
+    uint32_t commands;
+    uint32_t dropped;
+    uint32_t duplicated;
+    int lastInterval;
+    uint32_t averageInterval16; // Moving average of the interval, times 16
+    LogHistogram age;
+    LogHistogram jitter;
+};
+
+ClientLatency g_ClientLatencies[MAX_CLIENTS];
+
+// Wall clock time between server frames, frames that stall show up here and not in the
+// command ages of the clients
+LogHistogram g_FrameIntervals;
+uint64_t g_LastFrameStartTicks = 0;
+
+void ResetClientLatency(int clientNum)
+{
+    ClientLatency *pLatency = &g_ClientLatencies[clientNum];
+    pLatency->commands = 0;
+    pLatency->dropped = 0;
+    pLatency->duplicated = 0;
+    pLatency->lastInterval = 0;
+    pLatency->averageInterval16 = 0;
+    pLatency->age.Reset();
+    pLatency->jitter.Reset();
+}
+
+void ResetLatencies()
+{
+    for (int i = 0; i < MAX_CLIENTS; i++)
+        ResetClientLatency(i);
+
+    g_FrameIntervals.Reset();
+}
+
+// Called before the engine runs the command, cl->lastUsercmd is still the previous one
+void RecordUsercmd(client_t *cl, const usercmd_s *cmd)
+{
+    int clientNum = static_cast<int>((reinterpret_cast<uint8_t *>(cl) - reinterpret_cast<uint8_t *>(svsHeader->clients)) / sizeof(client_t));
+    if (clientNum < 0 || clientNum >= MAX_CLIENTS)
+        return;
+
+    ClientLatency *pLatency = &g_ClientLatencies[clientNum];
+
+    int age = svsHeader->time - cmd->serverTime;
+    pLatency->age.Add(age > 0 ? static_cast<uint32_t>(age) : 0);
+
+    if (pLatency->commands++ == 0)
+        return;
+
+    int interval = cmd->serverTime - cl->lastUsercmd.serverTime;
+    if (interval <= 0)
+    {
+        pLatency->duplicated++;
+        return;
+    }
+
+    int jitter = interval - pLatency->lastInterval;
+    pLatency->jitter.Add(static_cast<uint32_t>(jitter >= 0 ? jitter : -jitter));
+    pLatency->lastInterval = interval;
+
+    // Usercmds don't have a sequence number, lost ones are guessed from the gap they leave.
+    // The gap isn't folded into the average so a burst of losses doesn't hide the next one
+    uint32_t interval16 = static_cast<uint32_t>(interval) * 16;
+    uint32_t average16 = pLatency->averageInterval16;
+
+    if (pLatency->commands > LATENCY_MIN_COMMANDS && average16 != 0 && interval16 * 2 > average16 * LATENCY_DROP_FACTOR_X2)
+    {
+        pLatency->dropped += (interval16 + average16 / 2) / average16 - 1;
+        return;
+    }
+
+    if (average16 == 0)
+        pLatency->averageInterval16 = interval16;
+    else
+        pLatency->averageInterval16 = average16 + (static_cast<int>(interval16 - average16) >> 3);
+}
+
+// Returns the time since the previous frame started in ms, 0 for the first frame
+uint32_t RecordFrameInterval()
+{
+    uint64_t now = ReadTimeBase();
+    uint32_t intervalMs = 0;
+
+    if (g_LastFrameStartTicks != 0)
+    {
+        intervalMs = static_cast<uint32_t>(TimeBaseToUs(now - g_LastFrameStartTicks) / 1000);
+        g_FrameIntervals.Add(intervalMs);
+    }
+
+    g_LastFrameStartTicks = now;
+    return intervalMs;
+}
+
+// Writes "low-high:count" for every bucket that has values
+void FormatHistogram(const LogHistogram *pHistogram, char *buffer, size_t bufferSize)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+
+    for (int i = 0; i < LOG_HISTOGRAM_BUCKETS && length < bufferSize; i++)
+    {
+        uint32_t count = pHistogram->GetBucketCount(i);
+        if (count == 0)
+            continue;
+
+        int written = _snprintf_s(
+            buffer + length,
+            bufferSize - length,
+            _TRUNCATE,
+            " %u-%u:%u",
+            LogHistogram::GetBucketLow(i),
+            LogHistogram::GetBucketHigh(i),
+            count
+        );
+
+        if (written < 0)
+            break;
+
+        length += written;
+    }
+}
+
+void PrintClientLatency(int clientNum, int latencyClientNum)
+{
+    const ClientLatency *pLatency = &g_ClientLatencies[latencyClientNum];
+
+    PrintToClient(
+        clientNum,
+        "%d %s: %u cmds, age %u/%u/%u ms, jitter %u/%u/%u ms, %u dropped, %u duplicated",
+        latencyClientNum,
+        GetClientAtIndex(latencyClientNum)->name,
+        pLatency->commands,
+        pLatency->age.GetPercentile(50),
+        pLatency->age.GetPercentile(99),
+        pLatency->age.GetMax(),
+        pLatency->jitter.GetPercentile(50),
+        pLatency->jitter.GetPercentile(99),
+        pLatency->jitter.GetMax(),
+        pLatency->dropped,
+        pLatency->duplicated
+    );
+}
+
+// latency prints every connected client, latency <clientnum> also prints the buckets of that
+// client's histograms and latency reset clears everything. Values are p50/p99/max
+void Cmd_Latency_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    char argument[32];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    if (I_strnicmp(argument, "reset", 5) == 0)
+    {
+        ResetLatencies();
+        PrintToClient(clientNum, "latency: reset");
+        return;
+    }
+
+    PrintToClient(
+        clientNum,
+        "latency: server frame interval %u/%u/%u ms over %u frames",
+        g_FrameIntervals.GetPercentile(50),
+        g_FrameIntervals.GetPercentile(99),
+        g_FrameIntervals.GetMax(),
+        g_FrameIntervals.GetCount()
+    );
+
+    if (argument[0] != '\0')
+    {
+        int latencyClientNum = atoi(argument);
+        if (latencyClientNum < 0 || latencyClientNum >= MAX_CLIENTS || !IsClientBitSet(g_ClientStore.connectedBits, latencyClientNum))
+        {
+            PrintToClient(clientNum, "latency: no client %s", argument);
+            return;
+        }
+
+        char buckets[512];
+        PrintClientLatency(clientNum, latencyClientNum);
+
+        FormatHistogram(&g_ClientLatencies[latencyClientNum].age, buckets, sizeof(buckets));
+        PrintToClient(clientNum, "  age ms:%s", buckets);
+
+        FormatHistogram(&g_ClientLatencies[latencyClientNum].jitter, buckets, sizeof(buckets));
+        PrintToClient(clientNum, "  jitter ms:%s", buckets);
+        return;
+    }
+
+    ClientBitIterator iterator(g_ClientStore.connectedBits);
+    for (int i = iterator.Next(); i != -1; i = iterator.Next())
+        PrintClientLatency(clientNum, i);
+}
+
+// Params are the name of the stat: "age", "age99", "agemax", "jitter", "jitter99",
+// "jittermax", "dropped", "duplicated" or "commands". age and jitter are medians in ms
+void GScr_GetInputLatency(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_CLIENTS)
+    {
+        Scr_ObjectError("not a client\n");
+        return;
+    }
+
+    const ClientLatency *pLatency = &g_ClientLatencies[entref.entnum];
+    const char *stat = Scr_GetString(0);
+    uint32_t value = 0;
+
+    if (std::strcmp(stat, "age") == 0)
+        value = pLatency->age.GetPercentile(50);
+    else if (std::strcmp(stat, "age99") == 0)
+        value = pLatency->age.GetPercentile(99);
+    else if (std::strcmp(stat, "agemax") == 0)
+        value = pLatency->age.GetMax();
+    else if (std::strcmp(stat, "jitter") == 0)
+        value = pLatency->jitter.GetPercentile(50);
+    else if (std::strcmp(stat, "jitter99") == 0)
+        value = pLatency->jitter.GetPercentile(99);
+    else if (std::strcmp(stat, "jittermax") == 0)
+        value = pLatency->jitter.GetMax();
+    else if (std::strcmp(stat, "dropped") == 0)
+        value = pLatency->dropped;
+    else if (std::strcmp(stat, "duplicated") == 0)
+        value = pLatency->duplicated;
+    else if (std::strcmp(stat, "commands") == 0)
+        value = pLatency->commands;
+    else
+    {
+        Scr_ObjectError("unknown latency stat\n");
+        return;
+    }
+
+    Scr_AddInt(static_cast<int>(value));
+}
+
+#define PHASE_HISTORY_FRAMES 16
+#define PHASE_WINDOW_FRAMES 1200 // 1 minute at 20 frames per second
+#define PHASE_DEFAULT_SPIKE_MS 75 // Frames are 50 ms apart, a frame this late means the previous one stalled
+#define PHASE_IDLE_MS 1000 // Frames run without players aren't seen, a gap this long isn't a stall
+
+// todo: find addresses for SV_Frame, G_RunFrame and SV_SendClientMessages. The game frame and the
+// snapshot sends aren't timed at all until then, only the parts that already go through a hook
+// are. Without SV_Frame a spike is also only seen as a late frame start, the interval between
+// two Frame_Run calls, not as a frame that took long. Phases are exclusive, links the engine
+// makes during client think count as entity links only
+enum ProfilePhase
+{
+    PHASE_PLUGIN_FRAME,
+    PHASE_CLIENT_THINK,
+    PHASE_CLIENT_COMMAND,
+    PHASE_LINK_ENTITY,
+    PHASE_COUNT,
+};
+
+const char *g_PhaseNames[PHASE_COUNT] = { "plugin frame", "client think", "client commands", "entity links" };
+
+struct PhaseFrame
+{
+    int serverTime;
+    uint32_t intervalMs;
+    uint32_t us[PHASE_COUNT];
+};
+
+struct SpikeReport
+{
+    uint32_t frameCount;
+    PhaseFrame frames[PHASE_HISTORY_FRAMES]; // Oldest first, the last one is the spike
+};
+
+class PhaseTimer;
+
+struct PhaseProfiler
+{
+    uint64_t ticks[PHASE_COUNT]; // Current frame
+    PhaseTimer *pCurrentTimer; // Innermost running scope, phases only run on the server thread
+    uint32_t samples;
+    LogHistogram windows[2][PHASE_COUNT]; // Previous and current window, in microseconds
+    int currentWindow;
+    uint32_t windowFrames;
+    PhaseFrame history[PHASE_HISTORY_FRAMES];
+    uint32_t historyCount;
+    int lastServerTime;
+    uint32_t spikeThresholdMs;
+    uint32_t spikes;
+    SpikeReport spike;
+    uint64_t totalSamples;
+    uint64_t totalIntervalMs;
+    uint32_t timerCostNs;
+};
+
+PhaseProfiler g_PhaseProfiler;
+
+// Adds the time spent in the scope to the phase of the current frame, two mftb per scope.
+// The time of scopes nested in it is taken out and only counted for their own phase
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(ProfilePhase phase)
+        : m_Phase(phase), m_pParent(g_PhaseProfiler.pCurrentTimer), m_NestedTicks(0), m_Start(ReadTimeBase())
+    {
+        g_PhaseProfiler.pCurrentTimer = this;
+    }
+
+    ~PhaseTimer()
+    {
+        uint64_t ticks = ReadTimeBase() - m_Start;
+
+        g_PhaseProfiler.ticks[m_Phase] += ticks - m_NestedTicks;
+        g_PhaseProfiler.samples++;
+        g_PhaseProfiler.pCurrentTimer = m_pParent;
+
+        if (m_pParent != nullptr)
+            m_pParent->m_NestedTicks += ticks;
+    }
+
+private:
+    ProfilePhase m_Phase;
+    PhaseTimer *m_pParent;
+    uint64_t m_NestedTicks;
+    uint64_t m_Start;
+};
+
+void ResetPhaseProfiler()
+{
+    PhaseProfiler *pProfiler = &g_PhaseProfiler;
+
+    memset(pProfiler->ticks, 0, sizeof(pProfiler->ticks));
+    pProfiler->samples = 0;
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        pProfiler->windows[0][i].Reset();
+        pProfiler->windows[1][i].Reset();
+    }
+
+    pProfiler->currentWindow = 0;
+    pProfiler->windowFrames = 0;
+    pProfiler->historyCount = 0;
+    pProfiler->spikes = 0;
+    pProfiler->spike.frameCount = 0;
+    pProfiler->totalSamples = 0;
+    pProfiler->totalIntervalMs = 0;
+}
+
+void InitPhaseProfiler()
+{
+    g_PhaseProfiler.spikeThresholdMs = PHASE_DEFAULT_SPIKE_MS;
+    ResetPhaseProfiler();
+
+    // Measures what timing a scope costs so the overhead can be reported
+    uint64_t start = ReadTimeBase();
+    for (int i = 0; i < 256; i++)
+    {
+        PhaseTimer timer(PHASE_PLUGIN_FRAME);
+    }
+
+    g_PhaseProfiler.timerCostNs = static_cast<uint32_t>(TimeBaseToUs((ReadTimeBase() - start) * 1000) / 256);
+    ResetPhaseProfiler();
+}
+
+// Closes the frame that just ended, called at the start of the next one with the time between them
+void EndPhaseFrame(uint32_t intervalMs)
+{
+    PhaseProfiler *pProfiler = &g_PhaseProfiler;
+
+    if (pProfiler->windowFrames == PHASE_WINDOW_FRAMES)
+    {
+        pProfiler->currentWindow ^= 1;
+        for (int i = 0; i < PHASE_COUNT; i++)
+            pProfiler->windows[pProfiler->currentWindow][i].Reset();
+
+        pProfiler->windowFrames = 0;
+    }
+
+    PhaseFrame *pFrame = &pProfiler->history[pProfiler->historyCount++ % PHASE_HISTORY_FRAMES];
+    pFrame->serverTime = svsHeader->time;
+    pFrame->intervalMs = intervalMs;
+
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        pFrame->us[i] = static_cast<uint32_t>(TimeBaseToUs(pProfiler->ticks[i]));
+        pProfiler->windows[pProfiler->currentWindow][i].Add(pFrame->us[i]);
+    }
+
+    bool idle = svsHeader->time - pProfiler->lastServerTime > PHASE_IDLE_MS;
+    pProfiler->lastServerTime = svsHeader->time;
+
+    pProfiler->windowFrames++;
+    pProfiler->totalSamples += pProfiler->samples;
+    if (!idle)
+        pProfiler->totalIntervalMs += intervalMs;
+
+    // The frames leading up to the spike are frozen until the next one
+    if (intervalMs > pProfiler->spikeThresholdMs && !idle)
+    {
+        uint32_t count = pProfiler->historyCount < PHASE_HISTORY_FRAMES ? pProfiler->historyCount : PHASE_HISTORY_FRAMES;
+        for (uint32_t i = 0; i < count; i++)
+            pProfiler->spike.frames[i] = pProfiler->history[(pProfiler->historyCount - count + i) % PHASE_HISTORY_FRAMES];
+
+        pProfiler->spike.frameCount = count;
+        pProfiler->spikes++;
+        TRACE_INSTANT("frame spike", intervalMs);
+    }
+
+    memset(pProfiler->ticks, 0, sizeof(pProfiler->ticks));
+    pProfiler->samples = 0;
+}
+
+// The previous and current windows together
+void GetPhaseWindow(int phase, LogHistogram *pHistogram)
+{
+    *pHistogram = g_PhaseProfiler.windows[0][phase];
+    pHistogram->Merge(g_PhaseProfiler.windows[1][phase]);
+}
+
+void PrintSpikeReport(int clientNum)
+{
+    const SpikeReport *pSpike = &g_PhaseProfiler.spike;
+    if (pSpike->frameCount == 0)
+    {
+        PrintToClient(clientNum, "phaseprofile: no spike over %u ms yet", g_PhaseProfiler.spikeThresholdMs);
+        return;
+    }
+
+    PrintToClient(clientNum, "phaseprofile: last spike, frame interval ms then us per phase");
+    for (uint32_t i = 0; i < pSpike->frameCount; i++)
+    {
+        const PhaseFrame *pFrame = &pSpike->frames[i];
+        PrintToClient(
+            clientNum,
+            "  %d: %u ms, %u / %u / %u / %u",
+            pFrame->serverTime,
+            pFrame->intervalMs,
+            pFrame->us[PHASE_PLUGIN_FRAME],
+            pFrame->us[PHASE_CLIENT_THINK],
+            pFrame->us[PHASE_CLIENT_COMMAND],
+            pFrame->us[PHASE_LINK_ENTITY]
+        );
+    }
+}
+
+// phaseprofile prints p50/p99/max per phase over the last one to two minutes, phaseprofile spike
+// prints the frames before the last spike, phaseprofile threshold <ms> sets what a spike is
+void Cmd_PhaseProfile_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+    PhaseProfiler *pProfiler = &g_PhaseProfiler;
+
+    char argument[32];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    if (I_strnicmp(argument, "reset", 5) == 0)
+    {
+        ResetPhaseProfiler();
+        PrintToClient(clientNum, "phaseprofile: reset");
+        return;
+    }
+
+    if (I_strnicmp(argument, "spike", 5) == 0)
+    {
+        PrintSpikeReport(clientNum);
+        return;
+    }
+
+    if (I_strnicmp(argument, "threshold", 9) == 0)
+    {
+        char value[32];
+        SV_Cmd_ArgvBuffer(2, value, sizeof(value));
+
+        int thresholdMs = atoi(value);
+        if (thresholdMs > 0)
+            pProfiler->spikeThresholdMs = static_cast<uint32_t>(thresholdMs);
+
+        PrintToClient(clientNum, "phaseprofile: spike threshold %u ms", pProfiler->spikeThresholdMs);
+        return;
+    }
+
+    // Share of the frame time spent reading the time base, in hundredths of a percent
+    uint32_t overhead = pProfiler->totalIntervalMs != 0 ? static_cast<uint32_t>(pProfiler->totalSamples * pProfiler->timerCostNs / (pProfiler->totalIntervalMs * 100)) : 0;
+
+    PrintToClient(
+        clientNum,
+        "phaseprofile: %u spikes over %u ms, timing costs %u ns per scope, %u.%02u%% of frame time",
+        pProfiler->spikes,
+        pProfiler->spikeThresholdMs,
+        pProfiler->timerCostNs,
+        overhead / 100,
+        overhead % 100
+    );
+    PrintToClient(clientNum, "  game frame and snapshot sends aren't timed, spikes are late frame starts");
+
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+        LogHistogram histogram;
+        GetPhaseWindow(i, &histogram);
+
+        PrintToClient(
+            clientNum,
+            "  %s: %u/%u/%u us over %u frames",
+            g_PhaseNames[i],
+            histogram.GetPercentile(50),
+            histogram.GetPercentile(99),
+            histogram.GetMax(),
+            histogram.GetCount()
+        );
+    }
+}
+
+#define TRACE_FILE_PATH_FORMAT "hdd:\\iw3xenon_%u.trace"
+#define TRACE_DUMP_FILES 4 // Dumps go round these so they can't fill the drive
+
+struct TraceDump
+{
+    volatile int32_t pending; // Cleared by the worker, the completion that reports it can be dropped
+    volatile bool resume;     // Tracing was on before the dump, or was started during it
+    int clientNum;
+    uint32_t index;
+    int32_t eventCount;
+};
+
+TraceDump g_TraceDump;
+uint32_t g_TraceDumpCount = 0;
+
+// Runs on a pool worker so the server frame doesn't wait on the drive
+void WriteTraceDump(void *pContext)
+{
+    TraceDump *pDump = static_cast<TraceDump *>(pContext);
+
+    char path[64];
+    _snprintf_s(path, _TRUNCATE, TRACE_FILE_PATH_FORMAT, pDump->index);
+
+    FILE *pFile = nullptr;
+    if (fopen_s(&pFile, path, "wb") != 0 || pFile == nullptr)
+        pDump->eventCount = -1;
+    else
+    {
+        pDump->eventCount = g_Tracer.Dump(pFile);
+        fclose(pFile);
+    }
+
+    if (pDump->resume)
+        g_Tracer.SetEnabled(true);
+
+    Atomic_StoreRelease(&pDump->pending, 0);
+}
+
+// Only reports the result, a dump started since owns the fields and this one isn't reported
+void CompleteTraceDump(void *pContext)
+{
+    TraceDump *pDump = static_cast<TraceDump *>(pContext);
+
+    if (Atomic_LoadAcquire(&pDump->pending) == 0 && IsClientBitSet(g_ClientStore.connectedBits, pDump->clientNum))
+    {
+        if (pDump->eventCount < 0)
+            PrintToClient(pDump->clientNum, "trace: couldn't write iw3xenon_%u.trace", pDump->index);
+        else
+            PrintToClient(pDump->clientNum, "trace: wrote %d events to iw3xenon_%u.trace", pDump->eventCount, pDump->index);
+    }
+}
+
+// trace start|stop|dump|status. Tracing is off until started, dump writes the last events of
+// every thread to the hard drive for tools/trace2json.py. Only the host can use it since it
+// slows down every frame and writes to the console's drive
+void Cmd_Trace_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    if (!IsHostClient(clientNum))
+    {
+        PrintToClient(clientNum, "trace: only the host can use this command");
+        return;
+    }
+
+    char argument[32];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    if (I_strnicmp(argument, "start", 5) == 0)
+    {
+        if (Atomic_LoadAcquire(&g_TraceDump.pending) != 0)
+        {
+            g_TraceDump.resume = true;
+            PrintToClient(clientNum, "trace: starts once the dump being written is done");
+            return;
+        }
+
+        g_Tracer.Clear();
+        g_Tracer.SetEnabled(true);
+        PrintToClient(clientNum, "trace: started");
+        return;
+    }
+
+    if (I_strnicmp(argument, "stop", 4) == 0)
+    {
+        g_Tracer.SetEnabled(false);
+        g_TraceDump.resume = false;
+        PrintToClient(clientNum, "trace: stopped");
+        return;
+    }
+
+    if (I_strnicmp(argument, "dump", 4) == 0)
+    {
+        if (Atomic_LoadAcquire(&g_TraceDump.pending) != 0)
+        {
+            PrintToClient(clientNum, "trace: a dump is already being written");
+            return;
+        }
+
+        // Tracing is paused while the rings are read
+        g_TraceDump.pending = 1;
+        g_TraceDump.resume = g_Tracer.IsEnabled();
+        g_TraceDump.clientNum = clientNum;
+        g_TraceDump.index = g_TraceDumpCount;
+        g_TraceDumpCount = (g_TraceDumpCount + 1) % TRACE_DUMP_FILES;
+        g_Tracer.SetEnabled(false);
+
+        if (!g_ThreadPool.Submit(WriteTraceDump, &g_TraceDump, CompleteTraceDump))
+        {
+            WriteTraceDump(&g_TraceDump);
+            CompleteTraceDump(&g_TraceDump);
+        }
+
+        return;
+    }
+
+    PrintToClient(
+        clientNum,
+        "trace: %s, %u events on %d threads, %u dropped from unknown threads",
+        g_Tracer.IsEnabled() ? "on" : "off",
+        g_Tracer.GetEventCount(),
+        g_Tracer.GetThreadCount(),
+        g_Tracer.GetDroppedCount()
+    );
+}
+
+#define MAX_USERINFO_LENGTH 1024
+#define USERINFO_SLOTS 64 // Power of 2, userinfo rarely has more than 20 keys
+#define MAX_USERINFO_KEYS (USERINFO_SLOTS / 2)
+
+struct UserinfoEntry
+{
+    uint32_t hash; // 0 for empty slots
+    uint16_t keyOffset;
+    uint16_t valueOffset;
+};
+
+// Copy of the client's userinfo with the separators replaced by terminators, and a hash set
+// of its keys pointing into it. Only parsed again once the text is actually different
+struct ParsedUserinfo
+{
+    uint32_t sourceHash;
+    int checkedTime; // Server time of the frame the hash was last compared in
+    uint32_t keyCount;
+    char text[MAX_USERINFO_LENGTH];
+    UserinfoEntry entries[USERINFO_SLOTS];
+};
+
+struct UserinfoStats
+{
+    uint32_t parses;
+    uint32_t unchanged;
+    uint32_t lookups;
+};
+
+ParsedUserinfo g_Userinfos[MAX_CLIENTS];
+UserinfoStats g_UserinfoStats;
+
+// The next read parses the userinfo again whatever its hash
+void InvalidateUserinfo(int clientNum)
+{
+    g_Userinfos[clientNum].keyCount = 0;
+}
+
+void InitUserinfos()
+{
+    memset(g_Userinfos, 0, sizeof(g_Userinfos));
+    for (int i = 0; i < MAX_CLIENTS; i++)
+        InvalidateUserinfo(i);
+}
+
+UserinfoEntry *FindUserinfoSlot(ParsedUserinfo *pUserinfo, const char *key, uint32_t hash)
+{
+    size_t slot = hash & (USERINFO_SLOTS - 1);
+
+    for (;;)
+    {
+        UserinfoEntry *pEntry = &pUserinfo->entries[slot];
+        if (pEntry->hash == 0)
+            return pEntry;
+
+        if (pEntry->hash == hash && I_strnicmp(&pUserinfo->text[pEntry->keyOffset], key, MAX_USERINFO_LENGTH) == 0)
+            return pEntry;
+
+        slot = (slot + 1) & (USERINFO_SLOTS - 1);
+    }
+}
+
+// "\key\value\key\value", when a key is there twice the first value wins like Info_ValueForKey
+void ParseUserinfo(ParsedUserinfo *pUserinfo, const char *userinfo)
+{
+    memset(pUserinfo->entries, 0, sizeof(pUserinfo->entries));
+    pUserinfo->keyCount = 0;
+    strncpy_s(pUserinfo->text, sizeof(pUserinfo->text), userinfo, _TRUNCATE);
+
+    char *cursor = pUserinfo->text;
+    if (*cursor == '\\')
+        cursor++;
+
+    while (*cursor != '\0' && pUserinfo->keyCount < MAX_USERINFO_KEYS)
+    {
+        char *key = cursor;
+        while (*cursor != '\\' && *cursor != '\0')
+            cursor++;
+
+        // A key without a value ends the string
+        if (*cursor == '\0')
+            break;
+
+        *cursor++ = '\0';
+        char *value = cursor;
+        while (*cursor != '\\' && *cursor != '\0')
+            cursor++;
+
+        if (*cursor == '\\')
+            *cursor++ = '\0';
+
+        uint32_t hash = HashNameNoCase(key, strlen(key));
+        UserinfoEntry *pEntry = FindUserinfoSlot(pUserinfo, key, hash);
+        if (pEntry->hash == 0)
+        {
+            pEntry->hash = hash;
+            pEntry->keyOffset = static_cast<uint16_t>(key - pUserinfo->text);
+            pEntry->valueOffset = static_cast<uint16_t>(value - pUserinfo->text);
+            pUserinfo->keyCount++;
+        }
+    }
+}
+
+// Case sensitive, unlike the keys a value that only changes case is still a change
+uint32_t HashUserinfoText(const char *userinfo)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_USERINFO_LENGTH && userinfo[i] != '\0'; i++)
+        hash = (hash ^ static_cast<uint8_t>(userinfo[i])) * 16777619u;
+
+    return hash;
+}
+
+// todo: find addresses for SV_DirectConnect and SV_UpdateUserinfo_f. Until then nothing tells
+// when a userinfo changes, a connect can be read from Callback_PlayerConnect before the plugin
+// sees it. So the text is hashed on the first read of every frame and the other reads of the
+// frame use the copy as is, a change made during the frame shows from the next one
+ParsedUserinfo *GetParsedUserinfo(int clientNum)
+{
+    ParsedUserinfo *pUserinfo = &g_Userinfos[clientNum];
+    if (pUserinfo->checkedTime == svsHeader->time && pUserinfo->keyCount != 0)
+        return pUserinfo;
+
+    pUserinfo->checkedTime = svsHeader->time;
+
+    const char *userinfo = GetClientAtIndex(clientNum)->userinfo;
+    uint32_t sourceHash = HashUserinfoText(userinfo);
+
+    // Clients send their whole userinfo again when a single dvar changes, often to the same value
+    if (sourceHash == pUserinfo->sourceHash && pUserinfo->keyCount != 0)
+    {
+        g_UserinfoStats.unchanged++;
+        return pUserinfo;
+    }
+
+    pUserinfo->sourceHash = sourceHash;
+    ParseUserinfo(pUserinfo, userinfo);
+    g_UserinfoStats.parses++;
+
+    return pUserinfo;
+}
+
+// Returns the value of the key in the client's userinfo, or an empty string like the engine
+const char *GetUserinfoValue(int clientNum, const char *key)
+{
+    ParsedUserinfo *pUserinfo = GetParsedUserinfo(clientNum);
+    g_UserinfoStats.lookups++;
+
+    const UserinfoEntry *pEntry = FindUserinfoSlot(pUserinfo, key, HashNameNoCase(key, strlen(key)));
+    return pEntry->hash != 0 ? &pUserinfo->text[pEntry->valueOffset] : "";
+}
+
+// todo: find address for Scr_AddString. Until then values are only readable as integers or
+// compared with a script string
+void GScr_GetUserinfoInt(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_CLIENTS)
+    {
+        Scr_ObjectError("not a client\n");
+        return;
+    }
+
+    Scr_AddInt(atoi(GetUserinfoValue(entref.entnum, Scr_GetString(0))));
+}
+
+void GScr_HasUserinfo(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_CLIENTS)
+    {
+        Scr_ObjectError("not a client\n");
+        return;
+    }
+
+    Scr_AddBool(GetUserinfoValue(entref.entnum, Scr_GetString(0))[0] != '\0');
+}
+
+// Params are the key and the value to compare with, case sensitive
+void GScr_UserinfoEquals(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_CLIENTS)
+    {
+        Scr_ObjectError("not a client\n");
+        return;
+    }
+
+    const char *value = GetUserinfoValue(entref.entnum, Scr_GetString(0));
+    Scr_AddBool(std::strcmp(value, Scr_GetString(1)) == 0);
+}
+
+// userinfo prints the cache stats, userinfo <clientnum> also prints the client's parsed keys
+void Cmd_Userinfo_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    char argument[16];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    PrintToClient(
+        clientNum,
+        "userinfo: %u parses, %u unchanged userinfos skipped, %u lookups",
+        g_UserinfoStats.parses,
+        g_UserinfoStats.unchanged,
+        g_UserinfoStats.lookups
+    );
+
+    if (argument[0] == '\0')
+        return;
+
+    int userinfoClientNum = atoi(argument);
+    if (userinfoClientNum < 0 || userinfoClientNum >= MAX_CLIENTS || !IsClientBitSet(g_ClientStore.connectedBits, userinfoClientNum))
+    {
+        PrintToClient(clientNum, "userinfo: no client %s", argument);
+        return;
+    }
+
+    const ParsedUserinfo *pUserinfo = GetParsedUserinfo(userinfoClientNum);
+    for (size_t i = 0; i < USERINFO_SLOTS; i++)
+    {
+        const UserinfoEntry *pEntry = &pUserinfo->entries[i];
+        if (pEntry->hash != 0)
+            PrintToClient(clientNum, "  %s: %s", &pUserinfo->text[pEntry->keyOffset], &pUserinfo->text[pEntry->valueOffset]);
+    }
+}
+
+// todo: find addresses for Scr_Notify, SL_GetString and SL_RemoveRefToString. Script timers on
+// timer_wheel.h need them to notify the entity when its timer fires, without them scripts could
+// only poll a timer and still need a thread per timer
+
+// A new client in the slot, nothing from the previous one carries over
+void OnClientConnect(int clientNum)
+{
+    TRACE_INSTANT("client connect", clientNum);
+    ResetClientStoreSlot(clientNum);
+    g_ClientStore.connectTime[clientNum] = svsHeader->time;
+    ResetClientHud(&g_ClientHuds[clientNum], nullptr);
+    ResetClientLatency(clientNum);
+    InvalidateUserinfo(clientNum);
+}
+
+void OnClientDisconnect(int clientNum)
+{
+    TRACE_INSTANT("client disconnect", clientNum);
+    ResetClientStoreSlot(clientNum);
+    ResetClientHud(&g_ClientHuds[clientNum], nullptr);
+}
+
+// todo: find addresses for SV_DirectConnect, SV_DropClient and ClientBegin. Until then this
+// polls: every client slot is read once per frame from Frame_Run and connects, disconnects and
+// spawns are detected from the state changing between two polls. A change is seen up to a frame
+// late, and a client that disconnects and a new one that connects to the same slot within one
+// frame look like a client that stayed
+void UpdateClientStore()
+{
+    int maxClients = svsHeader->maxclients < MAX_CLIENTS ? svsHeader->maxclients : MAX_CLIENTS;
+
+    memset(g_ClientStore.inGameBits, 0, sizeof(g_ClientStore.inGameBits));
+    memset(g_ClientStore.teamBits, 0, sizeof(g_ClientStore.teamBits));
+
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        int state = i < maxClients ? GetClientAtIndex(i)->header.state : CS_FREE;
+        bool wasConnected = g_ClientStore.state[i] >= CS_CONNECTED;
+        bool connected = state >= CS_CONNECTED;
+        uint32_t bit = 1u << (i & 31);
+
+        if (connected && !wasConnected)
+        {
+            OnClientConnect(i);
+            g_ClientStore.connectedBits[i >> 5] |= bit;
+        }
+        else if (!connected && wasConnected)
+        {
+            OnClientDisconnect(i);
+            g_ClientStore.connectedBits[i >> 5] &= ~bit;
+        }
+
+        g_ClientStore.state[i] = static_cast<uint8_t>(state);
+
+        if (!connected)
+            continue;
+
+        gclient_s *client = GetGclientAtIndex(i);
+        bool inGame = client->sess.connected == CON_CONNECTED;
+        g_ClientStore.inGame[i] = inGame;
+
+        if (!inGame)
+        {
+            g_ClientStore.team[i] = -1;
+            g_ClientStore.originX[i] = g_ClientStore.originY[i] = g_ClientStore.originZ[i] = CLIENT_STORE_FAR_AWAY;
+            continue;
+        }
+
+        int team = client->sess.cs.team;
+        g_ClientStore.inGameBits[i >> 5] |= bit;
+        if (team >= 0 && team < TEAM_NUM_TEAMS)
+            g_ClientStore.teamBits[team][i >> 5] |= bit;
+
+        g_ClientStore.team[i] = static_cast<int8_t>(team);
+        g_ClientStore.originX[i] = client->ps.origin[0];
+        g_ClientStore.originY[i] = client->ps.origin[1];
+        g_ClientStore.originZ[i] = client->ps.origin[2];
+    }
+}
+
+// Params are the client number to start after, -1 to start from the first one. Returns the
+// number of the next client in game or -1 when there are no more
+void GScr_GetNextLiveClient(scr_entref_t entref)
+{
+    int after = Scr_GetInt(0);
+    if (after >= MAX_CLIENTS - 1)
+    {
+        Scr_AddInt(-1);
+        return;
+    }
+
+    uint32_t bits[CLIENT_BIT_WORDS];
+    memcpy(bits, g_ClientStore.inGameBits, sizeof(bits));
+
+    // Clear every bit up to and including after
+    for (int word = 0; word < CLIENT_BIT_WORDS && after >= 0; word++)
+    {
+        int first = word << 5;
+        if (after >= first + 31)
+            bits[word] = 0;
+        else if (after >= first)
+            bits[word] &= ~0u << ((after - first) + 1);
+    }
+
+    ClientBitIterator iterator(bits);
+    Scr_AddInt(iterator.Next());
+}
+
+void GScr_GetLiveClientCount(scr_entref_t entref)
+{
+    Scr_AddInt(CountClientBits(g_ClientStore.inGameBits));
+}
+
+// Param is 0 for clients 0 to 31 and 1 for 32 to 63
+void GScr_GetLiveClientMask(scr_entref_t entref)
+{
+    int word = Scr_GetInt(0);
+    Scr_AddInt(word >= 0 && word < CLIENT_BIT_WORDS ? static_cast<int>(g_ClientStore.inGameBits[word]) : 0);
+}
+
+#define RANKINGS_PRINT_COUNT 10
+
+struct RankedClient
+{
+    int score;
+    int kills;
+    int deaths;
+    int team;
+};
+
+struct TeamTotals
+{
+    int players;
+    int score;
+    int kills;
+    int deaths;
+};
+
+struct RankingStats
+{
+    uint32_t changes;
+    uint32_t swaps;
+};
+
+// In game players ordered like the scoreboard: score, then kills, then fewest deaths, then
+// client number. The order is only touched for players whose fields changed since the last
+// frame, a change usually moves a player by a place or two. Rank and team lookups are O(1)
+struct Rankings
+{
+    int count;
+    uint8_t order[MAX_CLIENTS];
+    int8_t ranks[MAX_CLIENTS]; // -1 when not ranked
+    RankedClient clients[MAX_CLIENTS];
+    TeamTotals teams[TEAM_NUM_TEAMS];
+    RankingStats stats;
+};
+
+Rankings g_Rankings;
+
+void InitRankings()
+{
+    memset(&g_Rankings, 0, sizeof(g_Rankings));
+    memset(g_Rankings.ranks, -1, sizeof(g_Rankings.ranks));
+}
+
+bool RanksAbove(int a, int b)
+{
+    const RankedClient *pA = &g_Rankings.clients[a];
+    const RankedClient *pB = &g_Rankings.clients[b];
+
+    if (pA->score != pB->score)
+        return pA->score > pB->score;
+    if (pA->kills != pB->kills)
+        return pA->kills > pB->kills;
+    if (pA->deaths != pB->deaths)
+        return pA->deaths < pB->deaths;
+
+    return a < b;
+}
+
+void SwapRanks(int position)
+{
+    uint8_t upper = g_Rankings.order[position];
+    uint8_t lower = g_Rankings.order[position + 1];
+
+    g_Rankings.order[position] = lower;
+    g_Rankings.order[position + 1] = upper;
+    g_Rankings.ranks[lower] = static_cast<int8_t>(position);
+    g_Rankings.ranks[upper] = static_cast<int8_t>(position + 1);
+    g_Rankings.stats.swaps++;
+}
+
+// Moves the client up or down until its neighbours are in order again
+void RepositionRankedClient(int clientNum)
+{
+    int position = g_Rankings.ranks[clientNum];
+
+    while (position > 0 && RanksAbove(clientNum, g_Rankings.order[position - 1]))
+        SwapRanks(--position);
+
+    while (position < g_Rankings.count - 1 && RanksAbove(g_Rankings.order[position + 1], clientNum))
+        SwapRanks(position++);
+}
+
+void AddTeamTotals(const RankedClient *pClient, int sign)
+{
+    if (pClient->team < 0 || pClient->team >= TEAM_NUM_TEAMS)
+        return;
+
+    TeamTotals *pTeam = &g_Rankings.teams[pClient->team];
+    pTeam->players += sign;
+    pTeam->score += pClient->score * sign;
+    pTeam->kills += pClient->kills * sign;
+    pTeam->deaths += pClient->deaths * sign;
+}
+
+void AddRankedClient(int clientNum, const RankedClient *pValues)
+{
+    g_Rankings.clients[clientNum] = *pValues;
+    g_Rankings.order[g_Rankings.count] = static_cast<uint8_t>(clientNum);
+    g_Rankings.ranks[clientNum] = static_cast<int8_t>(g_Rankings.count++);
+    AddTeamTotals(pValues, 1);
+
+    RepositionRankedClient(clientNum);
+}
+
+void RemoveRankedClient(int clientNum)
+{
+    AddTeamTotals(&g_Rankings.clients[clientNum], -1);
+
+    for (int i = g_Rankings.ranks[clientNum]; i < g_Rankings.count - 1; i++)
+    {
+        g_Rankings.order[i] = g_Rankings.order[i + 1];
+        g_Rankings.ranks[g_Rankings.order[i]] = static_cast<int8_t>(i);
+    }
+
+    g_Rankings.count--;
+    g_Rankings.ranks[clientNum] = -1;
+}
+
+// todo: find addresses for the score updates (AddPlayerScore is script side, ClientBegin and
+// player_die on the engine side). Until then the fields are compared once per frame
+TaskResult Task_UpdateRankings(Task *pTask)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        bool ranked = g_Rankings.ranks[i] != -1;
+        bool inGame = IsClientBitSet(g_ClientStore.inGameBits, i);
+
+        if (!inGame)
+        {
+            if (ranked)
+                RemoveRankedClient(i);
+            continue;
+        }
+
+        const clientSession_t *pSession = &GetGclientAtIndex(i)->sess;
+        RankedClient values = { pSession->score, pSession->kills, pSession->deaths, g_ClientStore.team[i] };
+
+        if (!ranked)
+        {
+            AddRankedClient(i, &values);
+            g_Rankings.stats.changes++;
+            continue;
+        }
+
+        RankedClient *pClient = &g_Rankings.clients[i];
+        if (memcmp(pClient, &values, sizeof(values)) == 0)
+            continue;
+
+        AddTeamTotals(pClient, -1);
+        *pClient = values;
+        AddTeamTotals(pClient, 1);
+
+        RepositionRankedClient(i);
+        g_Rankings.stats.changes++;
+    }
+
+    return TASK_DONE;
+}
+
+int GetTeamFromName(const char *name)
+{
+    if (std::strcmp(name, "axis") == 0)
+        return TEAM_AXIS;
+    if (std::strcmp(name, "allies") == 0)
+        return TEAM_ALLIES;
+    if (std::strcmp(name, "spectator") == 0)
+        return TEAM_SPECTATOR;
+    if (std::strcmp(name, "free") == 0)
+        return TEAM_FREE;
+
+    return -1;
+}
+
+// Returns the player's place in the rankings starting at 0, or -1 if not in game
+void GScr_GetRank(scr_entref_t entref)
+{
+    Scr_AddInt(entref.entnum < MAX_CLIENTS ? g_Rankings.ranks[entref.entnum] : -1);
+}
+
+// Params are the place starting at 0. Returns the entity number of the player at that place
+// or -1. Loop up to n for the top n players
+void GScr_GetPlayerAtRank(scr_entref_t entref)
+{
+    int rank = Scr_GetInt(0);
+    Scr_AddInt(rank >= 0 && rank < g_Rankings.count ? g_Rankings.order[rank] : -1);
+}
+
+void GScr_GetRankedPlayerCount(scr_entref_t entref)
+{
+    Scr_AddInt(g_Rankings.count);
+}
+
+// Params are the team ("axis", "allies", "spectator" or "free") and the stat ("score",
+// "kills", "deaths" or "players"). Totals are over the team's in game players
+void GScr_GetTeamTotal(scr_entref_t entref)
+{
+    int team = GetTeamFromName(Scr_GetString(0));
+    const char *stat = Scr_GetString(1);
+
+    if (team == -1)
+    {
+        Scr_ObjectError("unknown team\n");
+        return;
+    }
+
+    const TeamTotals *pTeam = &g_Rankings.teams[team];
+
+    if (std::strcmp(stat, "score") == 0)
+        Scr_AddInt(pTeam->score);
+    else if (std::strcmp(stat, "kills") == 0)
+        Scr_AddInt(pTeam->kills);
+    else if (std::strcmp(stat, "deaths") == 0)
+        Scr_AddInt(pTeam->deaths);
+    else if (std::strcmp(stat, "players") == 0)
+        Scr_AddInt(pTeam->players);
+    else
+        Scr_ObjectError("unknown team stat\n");
+}
+
+void Cmd_Rankings_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "rankings: %d players, %u changes, %u swaps, axis %d/%d/%d, allies %d/%d/%d (score/kills/deaths)",
+        g_Rankings.count,
+        g_Rankings.stats.changes,
+        g_Rankings.stats.swaps,
+        g_Rankings.teams[TEAM_AXIS].score,
+        g_Rankings.teams[TEAM_AXIS].kills,
+        g_Rankings.teams[TEAM_AXIS].deaths,
+        g_Rankings.teams[TEAM_ALLIES].score,
+        g_Rankings.teams[TEAM_ALLIES].kills,
+        g_Rankings.teams[TEAM_ALLIES].deaths
+    );
+
+    for (int i = 0; i < g_Rankings.count && i < RANKINGS_PRINT_COUNT; i++)
+    {
+        int rankedClientNum = g_Rankings.order[i];
+        const RankedClient *pClient = &g_Rankings.clients[rankedClientNum];
+
+        PrintToClient(
+            clientNum,
+            "  %d. %s: %d (%d/%d)",
+            i + 1,
+            GetClientAtIndex(rankedClientNum)->name,
+            pClient->score,
+            pClient->kills,
+            pClient->deaths
+        );
+    }
+}
+
+// Script setters only touch the desired state, the changes of a whole frame are applied
+// here in one go
+TaskResult Task_UpdateHuds(Task *pTask)
+{
+    ClientBitIterator iterator(g_ClientStore.connectedBits);
+
+    for (int i = iterator.Next(); i != -1; i = iterator.Next())
+    {
+        ClientHud *pHud = &g_ClientHuds[i];
+        if (!pHud->active)
+            continue;
+
+        if (!g_ClientStore.inGame[i])
+        {
+            ResetClientHud(pHud, nullptr);
+            continue;
+        }
+
+        UpdateClientHud(pHud, GetGclientAtIndex(i)->ps.hud.current);
+    }
+
+    return TASK_DONE;
+}
+
+NativeHudElem *Scr_GetNativeHudElem(scr_entref_t entref, unsigned int index)
+{
+    NativeHudElem *pElem = GetNativeHudElem(entref.entnum, Scr_GetInt(index));
+    if (pElem == nullptr)
+        Scr_ObjectError("invalid native hudelem handle\n");
+
+    return pElem;
+}
+
+void GScr_CreateNativeHudElem(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_CLIENTS)
+    {
+        Scr_ObjectError("not a client\n");
+        return;
+    }
+
+    ClientHud *pHud = &g_ClientHuds[entref.entnum];
+    int priority = Scr_GetInt(0);
+
+    for (int i = 0; i < MAX_NATIVE_HUDELEMS; i++)
+    {
+        NativeHudElem *pElem = &pHud->elems[i];
+        if (pElem->inUse)
+            continue;
+
+        memset(pElem, 0, sizeof(NativeHudElem));
+        pElem->inUse = true;
+        pElem->priority = priority;
+        pElem->slot = -1;
+        pElem->desired.type = HE_TYPE_VALUE;
+        pElem->desired.fontScale = 1.0f;
+        pElem->desired.color.rgba = -1;
+        pHud->active = true;
+
+        Scr_AddInt(i);
+        return;
+    }
+
+    Scr_AddInt(-1);
+}
+
+void GScr_DestroyNativeHudElem(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem != nullptr)
+        pElem->inUse = false;
+}
+
+void GScr_SetNativeHudElemPosition(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem == nullptr)
+        return;
+
+    pElem->desired.x = Scr_GetFloat(1);
+    pElem->desired.y = Scr_GetFloat(2);
+}
+
+void GScr_SetNativeHudElemValue(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem == nullptr)
+        return;
+
+    pElem->desired.type = HE_TYPE_VALUE;
+    pElem->desired.value = Scr_GetFloat(1);
+}
+
+void GScr_SetNativeHudElemTimer(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem == nullptr)
+        return;
+
+    pElem->desired.type = HE_TYPE_TIMER_DOWN;
+    pElem->desired.time = svsHeader->time + static_cast<int>(Scr_GetFloat(1) * 1000.0f);
+}
+
+unsigned __int8 ColorToByte(float value)
+{
+    if (value <= 0.0f)
+        return 0;
+
+    if (value >= 1.0f)
+        return 255;
+
+    return static_cast<unsigned __int8>(value * 255.0f);
+}
+
+void GScr_SetNativeHudElemColor(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem == nullptr)
+        return;
+
+    float color[3];
+    Scr_GetVector(1, color);
+    float alpha = Scr_GetFloat(2);
+
+    pElem->desired.color.__s0.r = ColorToByte(color[0]);
+    pElem->desired.color.__s0.g = ColorToByte(color[1]);
+    pElem->desired.color.__s0.b = ColorToByte(color[2]);
+    pElem->desired.color.__s0.a = ColorToByte(alpha);
+}
+
+void GScr_SetNativeHudElemFontScale(scr_entref_t entref)
+{
+    NativeHudElem *pElem = Scr_GetNativeHudElem(entref, 0);
+    if (pElem != nullptr)
+        pElem->desired.fontScale = Scr_GetFloat(1);
+}
+
+void Cmd_HudStats_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "hudstats: %u words written, %u skipped, %u evictions, %u slots lost",
+        g_HudStats.wordsWritten,
+        g_HudStats.wordsSkipped,
+        g_HudStats.evictions,
+        g_HudStats.slotsLost
+    );
+}
+
+#define MAX_QUEUED_BRUSH_MODEL_CLONES 512
+#define MAX_CACHED_BRUSH_MODELS 512
+
+struct BrushModelClone
+{
+    int scriptEntityNum;
+    int brushIndex;
+};
+
+// What SV_SetBrushModel resolves for a brush model, it only depends on s.index
+struct BrushModelBounds
+{
+    float mins[3];
+    float maxs[3];
+    int contents;
+    bool resolved;
+};
+
+BrushModelClone g_QueuedBrushModelClones[MAX_QUEUED_BRUSH_MODEL_CLONES];
+size_t g_QueuedBrushModelCloneCount = 0;
+bool g_BrushModelCloneQueued[MAX_GENTITIES];
+BrushModelBounds g_BrushModelBounds[MAX_CACHED_BRUSH_MODELS];
+
+void InitBrushModelClones()
+{
+    g_QueuedBrushModelCloneCount = 0;
+    memset(g_BrushModelCloneQueued, 0, sizeof(g_BrushModelCloneQueued));
+    memset(g_BrushModelBounds, 0, sizeof(g_BrushModelBounds));
+}
+
+void SetBrushModel(gentity_s *ent)
+{
+    int index = ent->s.index;
+    if (index >= MAX_CACHED_BRUSH_MODELS)
+    {
+        SV_SetBrushModel(ent);
+        return;
+    }
+
+    BrushModelBounds *pBounds = &g_BrushModelBounds[index];
+    if (!pBounds->resolved)
+    {
+        SV_SetBrushModel(ent);
+        memcpy(pBounds->mins, ent->r.mins, sizeof(pBounds->mins));
+        memcpy(pBounds->maxs, ent->r.maxs, sizeof(pBounds->maxs));
+        pBounds->contents = ent->r.contents;
+        pBounds->resolved = true;
+        return;
+    }
+
+    memcpy(ent->r.mins, pBounds->mins, sizeof(ent->r.mins));
+    memcpy(ent->r.maxs, pBounds->maxs, sizeof(ent->r.maxs));
+    ent->r.contents = pBounds->contents;
+    ent->r.bmodel = 1;
+}
+
+// Applies every queued clone, all the entities are unlinked first and linked again once
+// they all have their new collision so the world sectors are only walked twice per entity
+size_t FlushBrushModelClones()
+{
+    size_t count = g_QueuedBrushModelCloneCount;
+    g_QueuedBrushModelCloneCount = 0;
+
+    // Entities freed since they were queued have their flag cleared by G_FreeEntityHook
+    for (size_t i = 0; i < count; i++)
+    {
+        int entityNum = g_QueuedBrushModelClones[i].scriptEntityNum;
+        if (g_BrushModelCloneQueued[entityNum])
+            SV_UnlinkEntity(GetEntityAtIndex(entityNum));
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int entityNum = g_QueuedBrushModelClones[i].scriptEntityNum;
+        if (!g_BrushModelCloneQueued[entityNum])
+            continue;
+
+        gentity_s *ent = GetEntityAtIndex(entityNum);
+        int contents = ent->r.contents;
+
+        ent->s.index = g_QueuedBrushModelClones[i].brushIndex;
+        SetBrushModel(ent);
+        ent->r.contents |= contents;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int entityNum = g_QueuedBrushModelClones[i].scriptEntityNum;
+        if (!g_BrushModelCloneQueued[entityNum])
+            continue;
+
+        g_BrushModelCloneQueued[entityNum] = false;
+        SV_LinkEntity(GetEntityAtIndex(entityNum));
+    }
+
+    return count;
+}
+
+// Clones queued by a script that didn't flush them are applied at the start of the next frame
+TaskResult Task_FlushBrushModelClones(Task *pTask)
+{
+    if (g_QueuedBrushModelCloneCount != 0)
+        FlushBrushModelClones();
+
+    return TASK_DONE;
+}
+
+void GScr_QueueBrushModelClone(scr_entref_t entref)
+{
+    gentity_s *brushEnt = Scr_GetEntity(0);
+
+    // Everything is checked here so the flush can't fail half way through
+    if (entref.entnum < MAX_CLIENTS || entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("only script models can be cloned into\n");
+        return;
+    }
+
+    if (brushEnt->s.index == 0)
+    {
+        Scr_ObjectError("brush model entity has no collision model\n");
+        return;
+    }
+
+    if (g_BrushModelCloneQueued[entref.entnum])
+    {
+        Scr_ObjectError("entity already has a queued clone\n");
+        return;
+    }
+
+    if (g_QueuedBrushModelCloneCount == MAX_QUEUED_BRUSH_MODEL_CLONES)
+        FlushBrushModelClones();
+
+    BrushModelClone *pClone = &g_QueuedBrushModelClones[g_QueuedBrushModelCloneCount++];
+    pClone->scriptEntityNum = entref.entnum;
+    pClone->brushIndex = brushEnt->s.index;
+    g_BrushModelCloneQueued[entref.entnum] = true;
+}
+
+void GScr_FlushBrushModelClones(scr_entref_t entref)
+{
+    TRACE_SPAN("flushbrushmodelclones");
+    Scr_AddInt(static_cast<int>(FlushBrushModelClones()));
+}
+
+struct DeferredLinkStats
+{
+    uint32_t deferred;
+    uint32_t flushed;
+    uint32_t maxFlushedPerFrame;
+};
+
+// Entities that opted in have their relinks held back while the frame runs and applied once
+// by the flush task, before the next game frame runs. An entity is only relinked once no
+// matter how many times its origin was written in between.
+// todo: find address for SV_SendClientMessages. The flush can't run before the snapshot yet,
+// so the snapshot of the frame still sees the old link. Only entities without contents defer,
+// traces never hit those so only the snapshot's visibility check sees the stale position
+uint32_t g_DeferredLinkEntities[MAX_GENTITIES / 32];
+uint32_t g_PendingLinkEntities[MAX_GENTITIES / 32];
+DeferredLinkStats g_DeferredLinkStats;
+
+Detour *pSV_LinkEntityDetour = nullptr;
+Detour *pSV_UnlinkEntityDetour = nullptr;
+
+void InitDeferredLinks()
+{
+    memset(g_DeferredLinkEntities, 0, sizeof(g_DeferredLinkEntities));
+    memset(g_PendingLinkEntities, 0, sizeof(g_PendingLinkEntities));
+    memset(&g_DeferredLinkStats, 0, sizeof(g_DeferredLinkStats));
+}
+
+inline bool IsEntityBitSet(const uint32_t *pBits, int entityNum)
+{
+    return (pBits[entityNum >> 5] & (1u << (entityNum & 31))) != 0;
+}
+
+inline void SetEntityBit(uint32_t *pBits, int entityNum)
+{
+    pBits[entityNum >> 5] |= 1u << (entityNum & 31);
+}
+
+inline void ClearEntityBit(uint32_t *pBits, int entityNum)
+{
+    pBits[entityNum >> 5] &= ~(1u << (entityNum & 31));
+}
+
+// Links the entity right away, even if it deferred links
+void LinkEntityNow(gentity_s *ent)
+{
+    pSV_LinkEntityDetour->GetOriginal<void (*)(gentity_s *)>()(ent);
+}
+
+void SV_LinkEntityHook(gentity_s *ent)
+{
+    PhaseTimer timer(PHASE_LINK_ENTITY);
+    int entityNum = ent->s.number;
+
+    // The first link goes through so the entity is in the world as soon as it's spawned, an
+    // entity that was made solid since it opted in is linked right away too
+    if (ent->r.linked && ent->r.contents == 0 && entityNum >= 0 && entityNum < MAX_GENTITIES && IsEntityBitSet(g_DeferredLinkEntities, entityNum))
+    {
+        SetEntityBit(g_PendingLinkEntities, entityNum);
+        g_DeferredLinkStats.deferred++;
+        return;
+    }
+
+    LinkEntityNow(ent);
+}
+
+void SV_UnlinkEntityHook(gentity_s *ent)
+{
+    // A pending link must not put an unlinked entity back in the world
+    int entityNum = ent->s.number;
+    if (entityNum >= 0 && entityNum < MAX_GENTITIES)
+        ClearEntityBit(g_PendingLinkEntities, entityNum);
+
+    pSV_UnlinkEntityDetour->GetOriginal<decltype(&SV_UnlinkEntityHook)>()(ent);
+}
+
+void FlushDeferredLinks()
+{
+    uint32_t count = 0;
+
+    for (int word = 0; word < MAX_GENTITIES / 32; word++)
+    {
+        uint32_t bits = g_PendingLinkEntities[word];
+        g_PendingLinkEntities[word] = 0;
+
+        while (bits != 0)
+        {
+            uint32_t bit = 31 - CountLeadingZeros(bits);
+            bits &= ~(1u << bit);
+
+            // SV_LinkEntity unlinks the entity from its old sectors itself
+            LinkEntityNow(GetEntityAtIndex((word << 5) + bit));
+            count++;
+        }
+    }
+
+    g_DeferredLinkStats.flushed += count;
+    if (count > g_DeferredLinkStats.maxFlushedPerFrame)
+        g_DeferredLinkStats.maxFlushedPerFrame = count;
+}
+
+TaskResult Task_FlushDeferredLinks(Task *pTask)
+{
+    FlushDeferredLinks();
+    return TASK_DONE;
+}
+
+void GScr_SetDeferredLink(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_GENTITIES)
+        return;
+
+    if (Scr_GetInt(0))
+    {
+        if (GetEntityAtIndex(entref.entnum)->r.contents != 0)
+        {
+            Scr_ObjectError("only entities without contents can defer links\n");
+            return;
+        }
+
+        SetEntityBit(g_DeferredLinkEntities, entref.entnum);
+        return;
+    }
+
+    ClearEntityBit(g_DeferredLinkEntities, entref.entnum);
+
+    if (IsEntityBitSet(g_PendingLinkEntities, entref.entnum))
+    {
+        ClearEntityBit(g_PendingLinkEntities, entref.entnum);
+        LinkEntityNow(GetEntityAtIndex(entref.entnum));
+        g_DeferredLinkStats.flushed++;
+    }
+}
+
+void Cmd_DeferredLinks_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "deferredlinks: %u deferred, %u relinked, %u saved, at most %u relinks in a frame",
+        g_DeferredLinkStats.deferred,
+        g_DeferredLinkStats.flushed,
+        g_DeferredLinkStats.deferred - g_DeferredLinkStats.flushed,
+        g_DeferredLinkStats.maxFlushedPerFrame
+    );
+}
+
+#define MAX_NATIVE_MOVERS 256
+
+// Position of an engine trajectory, same math clients use to interpolate lerp.pos
+void EvaluateEntityTrajectory(const trajectory_t *pTrajectory, int atTime, float *pPosition, float *pVelocity)
+{
+    EvaluateTrajectory(pTrajectory->trType, pTrajectory->trTime, pTrajectory->trDuration, pTrajectory->trBase, pTrajectory->trDelta, atTime, pPosition, pVelocity);
+}
+
+struct NativeMoverStats
+{
+    uint32_t segments;
+    uint32_t updates;
+    uint32_t interrupted;
+    uint64_t lastTicks;
+    uint64_t maxTicks;
+};
+
+// Entities moved through lerp.pos. Clients interpolate the trajectory on their side, the server
+// only evaluates it once per frame to keep collision in sync
+uint16_t g_NativeMovers[MAX_NATIVE_MOVERS];
+TrajectoryBatch<MAX_NATIVE_MOVERS> g_NativeMoverTrajectories;
+int16_t g_NativeMoverIndices[MAX_GENTITIES];
+size_t g_NativeMoverCount = 0;
+NativeMoverStats g_NativeMoverStats;
+
+void InitNativeMovers()
+{
+    g_NativeMoverCount = 0;
+    memset(g_NativeMoverIndices, 0xFF, sizeof(g_NativeMoverIndices));
+    memset(&g_NativeMoverStats, 0, sizeof(g_NativeMoverStats));
+}
+
+void RemoveNativeMover(int entityNum)
+{
+    int index = g_NativeMoverIndices[entityNum];
+    if (index == -1)
+        return;
+
+    uint16_t last = g_NativeMovers[--g_NativeMoverCount];
+    g_NativeMovers[index] = last;
+    g_NativeMoverIndices[last] = static_cast<int16_t>(index);
+    g_NativeMoverIndices[entityNum] = -1;
+}
+
+// Leaves the entity where it is with a stationary trajectory
+void StopNativeMover(gentity_s *ent)
+{
+    trajectory_t *pTrajectory = &ent->s.lerp.pos;
+
+    EvaluateEntityTrajectory(pTrajectory, svsHeader->time, pTrajectory->trBase, nullptr);
+    pTrajectory->trType = TR_STATIONARY;
+    pTrajectory->trTime = svsHeader->time;
+    pTrajectory->trDuration = 0;
+    memset(pTrajectory->trDelta, 0, sizeof(pTrajectory->trDelta));
+    memcpy(ent->r.currentOrigin, pTrajectory->trBase, sizeof(ent->r.currentOrigin));
+
+    RemoveNativeMover(ent->s.number);
+}
+
+void StartNativeMover(gentity_s *ent, trType_t type, int duration, const float *delta)
+{
+    int entityNum = ent->s.number;
+
+    if (g_NativeMoverIndices[entityNum] == -1)
+    {
+        if (g_NativeMoverCount == MAX_NATIVE_MOVERS)
+        {
+            Scr_ObjectError("too many native movers\n");
+            return;
+        }
+
+        g_NativeMoverIndices[entityNum] = static_cast<int16_t>(g_NativeMoverCount);
+        g_NativeMovers[g_NativeMoverCount++] = static_cast<uint16_t>(entityNum);
+    }
+
+    // A new segment starts from wherever the entity currently is
+    trajectory_t *pTrajectory = &ent->s.lerp.pos;
+    memcpy(pTrajectory->trBase, ent->r.currentOrigin, sizeof(pTrajectory->trBase));
+    memcpy(pTrajectory->trDelta, delta, sizeof(pTrajectory->trDelta));
+    pTrajectory->trType = type;
+    pTrajectory->trTime = svsHeader->time;
+    pTrajectory->trDuration = duration;
+
+    g_NativeMoverStats.segments++;
+}
+
+bool IsFiniteTrajectory(trType_t type)
+{
+    return type == TR_LINEAR_STOP || type == TR_ACCELERATE || type == TR_DECELERATE;
+}
+
+TaskResult Task_UpdateNativeMovers(Task *pTask)
+{
+    uint64_t start = ReadTimeBase();
+    int time = svsHeader->time;
+
+    for (size_t i = 0; i < g_NativeMoverCount;)
+    {
+        gentity_s *ent = GetEntityAtIndex(g_NativeMovers[i]);
+        trajectory_t *pTrajectory = &ent->s.lerp.pos;
+
+        // Setting origin from a script makes the trajectory stationary, the script took over
+        if (pTrajectory->trType == TR_STATIONARY)
+        {
+            g_NativeMoverStats.interrupted++;
+            RemoveNativeMover(ent->s.number);
+            continue;
+        }
+
+        if (IsFiniteTrajectory(pTrajectory->trType) && time >= pTrajectory->trTime + pTrajectory->trDuration)
+        {
+            // StopNativeMover swaps the last mover into this index
+            StopNativeMover(ent);
+            LinkEntityNow(ent);
+            continue;
+        }
+
+        i++;
+    }
+
+    // Batch indices match mover indices since every remaining mover is added in order
+    g_NativeMoverTrajectories.Clear();
+    for (size_t i = 0; i < g_NativeMoverCount; i++)
+    {
+        const trajectory_t *pTrajectory = &GetEntityAtIndex(g_NativeMovers[i])->s.lerp.pos;
+        g_NativeMoverTrajectories.Add(pTrajectory->trType, pTrajectory->trTime, pTrajectory->trDuration, pTrajectory->trBase, pTrajectory->trDelta);
+    }
+
+    g_NativeMoverTrajectories.Evaluate(time);
+
+    for (size_t i = 0; i < g_NativeMoverCount; i++)
+    {
+        gentity_s *ent = GetEntityAtIndex(g_NativeMovers[i]);
+        g_NativeMoverTrajectories.GetPosition(i, ent->r.currentOrigin);
+        LinkEntityNow(ent);
+    }
+
+    g_NativeMoverStats.updates += static_cast<uint32_t>(g_NativeMoverCount);
+
+    uint64_t ticks = ReadTimeBase() - start;
+    g_NativeMoverStats.lastTicks = ticks;
+    if (ticks > g_NativeMoverStats.maxTicks)
+        g_NativeMoverStats.maxTicks = ticks;
+
+    return TASK_DONE;
+}
+
+gentity_s *Scr_GetNativeMover(scr_entref_t entref)
+{
+    if (entref.entnum < MAX_CLIENTS || entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("only non-client entities can be moved natively\n");
+        return nullptr;
+    }
+
+    return GetEntityAtIndex(entref.entnum);
+}
+
+// Params are the point to move to and the time in seconds
+void GScr_NativeMoveTo(scr_entref_t entref, trType_t type)
+{
+    gentity_s *ent = Scr_GetNativeMover(entref);
+    if (!ent)
+        return;
+
+    float point[3];
+    Scr_GetVector(0, point);
+    float seconds = Scr_GetFloat(1);
+
+    if (seconds <= 0.0f)
+    {
+        Scr_ObjectError("move time must be positive\n");
+        return;
+    }
+
+    // Linear covers the distance at delta per second, accelerate and decelerate average half of it
+    float scale = type == TR_LINEAR_STOP ? 1.0f / seconds : 2.0f / seconds;
+    float delta[3];
+    for (int i = 0; i < 3; i++)
+        delta[i] = (point[i] - ent->r.currentOrigin[i]) * scale;
+
+    StartNativeMover(ent, type, static_cast<int>(seconds * 1000.0f), delta);
+}
+
+void GScr_NativeMoveLinearStop(scr_entref_t entref)
+{
+    GScr_NativeMoveTo(entref, TR_LINEAR_STOP);
+}
+
+void GScr_NativeMoveAccelerate(scr_entref_t entref)
+{
+    GScr_NativeMoveTo(entref, TR_ACCELERATE);
+}
+
+void GScr_NativeMoveDecelerate(scr_entref_t entref)
+{
+    GScr_NativeMoveTo(entref, TR_DECELERATE);
+}
+
+void GScr_NativeMoveLinear(scr_entref_t entref)
+{
+    gentity_s *ent = Scr_GetNativeMover(entref);
+    if (!ent)
+        return;
+
+    float velocity[3];
+    Scr_GetVector(0, velocity);
+
+    StartNativeMover(ent, TR_LINEAR, 0, velocity);
+}
+
+void GScr_NativeMoveSine(scr_entref_t entref)
+{
+    gentity_s *ent = Scr_GetNativeMover(entref);
+    if (!ent)
+        return;
+
+    float amplitude[3];
+    Scr_GetVector(0, amplitude);
+    float period = Scr_GetFloat(1);
+
+    if (period <= 0.0f)
+    {
+        Scr_ObjectError("period must be positive\n");
+        return;
+    }
+
+    StartNativeMover(ent, TR_SINE, static_cast<int>(period * 1000.0f), amplitude);
+}
+
+void GScr_NativeMoveStop(scr_entref_t entref)
+{
+    gentity_s *ent = Scr_GetNativeMover(entref);
+    if (!ent || g_NativeMoverIndices[entref.entnum] == -1)
+        return;
+
+    StopNativeMover(ent);
+    LinkEntityNow(ent);
+}
+
+void GScr_IsNativeMoving(scr_entref_t entref)
+{
+    Scr_AddBool(entref.entnum < MAX_GENTITIES && g_NativeMoverIndices[entref.entnum] != -1);
+}
+
+TrajectoryBatch<MAX_GENTITIES> g_EntityTrajectories;
+uint16_t g_EntityTrajectoryNums[MAX_GENTITIES];
+
+bool IsEvaluatedTrajectory(trType_t type)
+{
+    return type >= TR_LINEAR && type <= TR_DECELERATE;
+}
+
+// Evaluates lerp.pos of every moving non-client entity at atTime in one batch. Results are
+// read from g_EntityTrajectories, g_EntityTrajectoryNums has the entity number of each one
+size_t EvaluateMovingEntities(int atTime)
+{
+    g_EntityTrajectories.Clear();
+
+    int entityCount = level->num_entities < MAX_GENTITIES ? level->num_entities : MAX_GENTITIES;
+    for (int i = MAX_CLIENTS; i < entityCount; i++)
+    {
+        gentity_s *ent = GetEntityAtIndex(i);
+        const trajectory_t *pTrajectory = &ent->s.lerp.pos;
+
+        if (!ent->r.inuse || !IsEvaluatedTrajectory(pTrajectory->trType))
+            continue;
+
+        g_EntityTrajectoryNums[g_EntityTrajectories.GetCount()] = static_cast<uint16_t>(i);
+        g_EntityTrajectories.Add(pTrajectory->trType, pTrajectory->trTime, pTrajectory->trDuration, pTrajectory->trBase, pTrajectory->trDelta);
+    }
+
+    g_EntityTrajectories.Evaluate(atTime);
+    return g_EntityTrajectories.GetCount();
+}
+
+// Params are the point, the radius and how many seconds from now
+void GScr_IsTrajectoryWithin(scr_entref_t entref)
+{
+    TRACE_SPAN_ARG("istrajectorywithin", entref.entnum);
+    float point[3];
+    Scr_GetVector(0, point);
+    float radius = Scr_GetFloat(1);
+    int atTime = svsHeader->time + static_cast<int>(Scr_GetFloat(2) * 1000.0f);
+
+    float position[3];
+    EvaluateEntityTrajectory(&GetEntityAtIndex(entref.entnum)->s.lerp.pos, atTime, position, nullptr);
+
+    float distanceSquared = 0.0f;
+    for (int i = 0; i < 3; i++)
+        distanceSquared += (position[i] - point[i]) * (position[i] - point[i]);
+
+    Scr_AddBool(distanceSquared <= radius * radius);
+}
+
+// Same params as istrajectorywithin, counts every moving entity that will be within radius
+void GScr_CountMovingEntitiesWithin(scr_entref_t entref)
+{
+    TRACE_SPAN("countmovingentitieswithin");
+    float point[3];
+    Scr_GetVector(0, point);
+    float radius = Scr_GetFloat(1);
+    int atTime = svsHeader->time + static_cast<int>(Scr_GetFloat(2) * 1000.0f);
+
+    size_t count = EvaluateMovingEntities(atTime);
+    const float *pX = g_EntityTrajectories.GetPositions(0);
+    const float *pY = g_EntityTrajectories.GetPositions(1);
+    const float *pZ = g_EntityTrajectories.GetPositions(2);
+    int within = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        float x = pX[i] - point[0];
+        float y = pY[i] - point[1];
+        float z = pZ[i] - point[2];
+
+        if (x * x + y * y + z * z <= radius * radius)
+            within++;
+    }
+
+    Scr_AddInt(within);
+}
+
+void Cmd_NativeMovers_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "nativemovers: %u moving, %u segments, %u updates, %u interrupted, last pass %uus (max %uus)",
+        static_cast<uint32_t>(g_NativeMoverCount),
+        g_NativeMoverStats.segments,
+        g_NativeMoverStats.updates,
+        g_NativeMoverStats.interrupted,
+        static_cast<uint32_t>(TimeBaseToUs(g_NativeMoverStats.lastTicks)),
+        static_cast<uint32_t>(TimeBaseToUs(g_NativeMoverStats.maxTicks))
+    );
+}
+
+#define MAX_CULLED_ENTITIES 256
+#define CULLING_BUDGET_US 300
+#define CULL_ANY_TEAM -1
+
+struct CulledEntity
+{
+    uint16_t entityNum;
+    float maxDistanceSquared; // 0 when there's no distance rule
+    int visibleTeam;          // team_t the entity is limited to, or CULL_ANY_TEAM
+    uint32_t culledBits[2];   // Bits this pass set in clientMask
+    uint32_t writtenBits[2];  // clientMask as this pass left it
+};
+
+struct CullingStats
+{
+    uint32_t passes;
+    uint32_t overBudgetPasses;
+    uint32_t lastHiddenCount;
+    uint64_t lastTicks;
+    uint64_t maxTicks;
+};
+
+// Entities that opted in get hidden from the snapshots of players that are too far away or
+// on the wrong team. A set bit in entityShared_t::clientMask hides the entity from that client,
+// bits set by scripts are kept as they are
+CulledEntity g_CulledEntities[MAX_CULLED_ENTITIES];
+int16_t g_CulledEntityIndices[MAX_GENTITIES];
+size_t g_CulledEntityCount = 0;
+CullingStats g_CullingStats;
+
+void InitCulling()
+{
+    g_CulledEntityCount = 0;
+    memset(g_CulledEntityIndices, 0xFF, sizeof(g_CulledEntityIndices));
+    memset(&g_CullingStats, 0, sizeof(g_CullingStats));
+}
+
+CulledEntity *GetCulledEntity(int entityNum, bool create)
+{
+    int index = g_CulledEntityIndices[entityNum];
+    if (index != -1)
+        return &g_CulledEntities[index];
+
+    if (!create || g_CulledEntityCount == MAX_CULLED_ENTITIES)
+        return nullptr;
+
+    CulledEntity *pCulled = &g_CulledEntities[g_CulledEntityCount];
+    memset(pCulled, 0, sizeof(CulledEntity));
+    pCulled->entityNum = static_cast<uint16_t>(entityNum);
+    pCulled->visibleTeam = CULL_ANY_TEAM;
+
+    g_CulledEntityIndices[entityNum] = static_cast<int16_t>(g_CulledEntityCount++);
+    return pCulled;
+}
+
+// Takes the bits this pass set back out of clientMask
+void RemoveCulledEntity(int entityNum, bool restoreMask)
+{
+    int index = g_CulledEntityIndices[entityNum];
+    if (index == -1)
+        return;
+
+    if (restoreMask)
+    {
+        gentity_s *ent = GetEntityAtIndex(entityNum);
+        for (int i = 0; i < 2; i++)
+            ent->r.clientMask[i] &= ~g_CulledEntities[index].culledBits[i];
+    }
+
+    g_CulledEntities[index] = g_CulledEntities[--g_CulledEntityCount];
+    g_CulledEntityIndices[g_CulledEntities[index].entityNum] = static_cast<int16_t>(index);
+    g_CulledEntityIndices[entityNum] = -1;
+}
+
+// Bits of the players further than the entity's max distance
+void GetFarClients(const CulledEntity *pCulled, const float *origin, uint32_t *pFarBits)
+{
+    SimdFloat4 x = Simd_Replicate(origin[0]);
+    SimdFloat4 y = Simd_Replicate(origin[1]);
+    SimdFloat4 z = Simd_Replicate(origin[2]);
+    SimdFloat4 maxDistanceSquared = Simd_Replicate(pCulled->maxDistanceSquared);
+
+    pFarBits[0] = pFarBits[1] = 0;
+
+    for (int i = 0; i < MAX_CLIENTS; i += 4)
+    {
+        SimdFloat4 dx = Simd_Subtract(Simd_Load4(&g_ClientStore.originX[i]), x);
+        SimdFloat4 dy = Simd_Subtract(Simd_Load4(&g_ClientStore.originY[i]), y);
+        SimdFloat4 dz = Simd_Subtract(Simd_Load4(&g_ClientStore.originZ[i]), z);
+        SimdFloat4 distanceSquared = Simd_MultiplyAdd(dz, dz, Simd_MultiplyAdd(dy, dy, Simd_Multiply(dx, dx)));
+
+        pFarBits[i >> 5] |= Simd_GreaterMask(distanceSquared, maxDistanceSquared) << (i & 31);
+    }
+}
+
+TaskResult Task_CullEntities(Task *pTask)
+{
+    uint64_t start = ReadTimeBase();
+    uint32_t hiddenCount = 0;
+
+    for (size_t i = 0; i < g_CulledEntityCount; i++)
+    {
+        CulledEntity *pCulled = &g_CulledEntities[i];
+        gentity_s *ent = GetEntityAtIndex(pCulled->entityNum);
+
+        uint32_t culledBits[2] = { 0, 0 };
+
+        if (pCulled->maxDistanceSquared > 0.0f)
+            GetFarClients(pCulled, ent->r.currentOrigin, culledBits);
+
+        // Spectators see everything
+        if (pCulled->visibleTeam != CULL_ANY_TEAM)
+        {
+            for (int word = 0; word < 2; word++)
+                culledBits[word] |= ~(g_ClientStore.teamBits[pCulled->visibleTeam][word] | g_ClientStore.teamBits[TEAM_SPECTATOR][word]);
+        }
+
+        for (int word = 0; word < 2; word++)
+        {
+            uint32_t current = static_cast<uint32_t>(ent->r.clientMask[word]);
+
+            // Bits a script changed since the last pass belong to the script from now on
+            uint32_t scriptChanged = current ^ pCulled->writtenBits[word];
+            uint32_t scriptBits = current & ~(pCulled->culledBits[word] & ~scriptChanged);
+
+            culledBits[word] &= g_ClientStore.inGameBits[word];
+            uint32_t mask = scriptBits | culledBits[word];
+
+            ent->r.clientMask[word] = static_cast<int>(mask);
+            pCulled->culledBits[word] = culledBits[word] & ~scriptBits;
+            pCulled->writtenBits[word] = mask;
+
+            for (uint32_t bits = pCulled->culledBits[word]; bits != 0; bits &= bits - 1)
+                hiddenCount++;
+        }
+    }
+
+    uint64_t ticks = ReadTimeBase() - start;
+    g_CullingStats.passes++;
+    g_CullingStats.lastHiddenCount = hiddenCount;
+    g_CullingStats.lastTicks = ticks;
+
+    if (ticks > g_CullingStats.maxTicks)
+        g_CullingStats.maxTicks = ticks;
+
+    if (TimeBaseToUs(ticks) > CULLING_BUDGET_US)
+        g_CullingStats.overBudgetPasses++;
+
+    return TASK_DONE;
+}
+
+// Param is the distance after which players don't see the entity, 0 removes the rule
+void GScr_SetCullDistance(scr_entref_t entref)
+{
+    if (entref.entnum < MAX_CLIENTS || entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("only non-client entities can be culled\n");
+        return;
+    }
+
+    float distance = Scr_GetFloat(0);
+    CulledEntity *pCulled = GetCulledEntity(entref.entnum, true);
+    if (!pCulled)
+    {
+        Scr_ObjectError("too many culled entities\n");
+        return;
+    }
+
+    pCulled->maxDistanceSquared = distance > 0.0f ? distance * distance : 0.0f;
+}
+
+// Param is "axis" or "allies" to only show the entity to that team, anything else removes the rule
+void GScr_SetCullTeam(scr_entref_t entref)
+{
+    if (entref.entnum < MAX_CLIENTS || entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("only non-client entities can be culled\n");
+        return;
+    }
+
+    const char *team = Scr_GetString(0);
+    CulledEntity *pCulled = GetCulledEntity(entref.entnum, true);
+    if (!pCulled)
+    {
+        Scr_ObjectError("too many culled entities\n");
+        return;
+    }
+
+    if (std::strcmp(team, "axis") == 0)
+        pCulled->visibleTeam = TEAM_AXIS;
+    else if (std::strcmp(team, "allies") == 0)
+        pCulled->visibleTeam = TEAM_ALLIES;
+    else
+        pCulled->visibleTeam = CULL_ANY_TEAM;
+}
+
+void GScr_DisableCulling(scr_entref_t entref)
+{
+    if (entref.entnum < MAX_GENTITIES)
+        RemoveCulledEntity(entref.entnum, true);
+}
+
+void Cmd_Culling_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "culling: %u entities, %u hidden pairs, last pass %uus (max %uus), %u of %u passes over %uus",
+        static_cast<uint32_t>(g_CulledEntityCount),
+        g_CullingStats.lastHiddenCount,
+        static_cast<uint32_t>(TimeBaseToUs(g_CullingStats.lastTicks)),
+        static_cast<uint32_t>(TimeBaseToUs(g_CullingStats.maxTicks)),
+        g_CullingStats.overBudgetPasses,
+        g_CullingStats.passes,
+        CULLING_BUDGET_US
+    );
+}
+
+#define SNAPSHOT_PROFILE_TOP_COUNT 5
+#define SNAPSHOT_ENTITY_TYPES 32
+#define SNAPSHOT_PACKET_BACKUP 32
+
+struct SnapshotProfile
+{
+    int lastNextEntities;
+    int lastNextCachedEntities;
+    uint32_t frames;
+    uint64_t totalSlots;
+    uint32_t maxSlotsPerFrame;
+    uint32_t maxCachedSlotsPerFrame;
+    uint32_t attributedFrames;
+    uint32_t unattributedFrames;
+    uint32_t entitySlots[MAX_GENTITIES];
+    uint32_t typeSlots[SNAPSHOT_ENTITY_TYPES]; // Event types share the last bucket
+    uint32_t clientSlots[MAX_CLIENTS];
+};
+
+SnapshotProfile g_SnapshotProfile;
+bool g_SnapshotProfileStarted = false;
+
+void ResetSnapshotProfile()
+{
+    memset(&g_SnapshotProfile, 0, sizeof(g_SnapshotProfile));
+    g_SnapshotProfileStarted = false;
+}
+
+// Snapshots are built one client at a time in client order, with the entities of each one
+// sorted by number. So a run of increasing entity numbers is usually one client's snapshot, and
+// the runs are matched to the active clients when there are as many of both. This is a guess:
+// a client that was skipped for its rate sends no snapshot, and two snapshots merge into one run
+// when the second starts above where the first ended. Either alone makes the counts differ and
+// the frame is only counted per entity and type, but both in the same frame cancel out and the
+// slots are attributed to the wrong clients.
+// todo: find address for SV_BuildClientSnapshot and attribute from a hook on it instead
+void AttributeSnapshotClients(const uint16_t *pRunLengths, size_t runCount)
+{
+    int activeClients[MAX_CLIENTS];
+    size_t activeCount = 0;
+    ClientBitIterator iterator(g_ClientStore.connectedBits);
+
+    for (int i = iterator.Next(); i != -1; i = iterator.Next())
+    {
+        if (g_ClientStore.state[i] == CS_ACTIVE)
+            activeClients[activeCount++] = i;
+    }
+
+    if (activeCount != runCount)
+    {
+        g_SnapshotProfile.unattributedFrames++;
+        return;
+    }
+
+    for (size_t i = 0; i < runCount; i++)
+        g_SnapshotProfile.clientSlots[activeClients[i]] += pRunLengths[i];
+
+    g_SnapshotProfile.attributedFrames++;
+}
+
+// Counts the snapshot entity slots written since the previous frame
+TaskResult Task_ProfileSnapshots(Task *pTask)
+{
+    int nextEntities = svsHeader->nextSnapshotEntities;
+    int nextCachedEntities = svsHeader->nextCachedSnapshotEntities;
+
+    // A counter that went backwards was reset by the server, the frame is skipped and counting
+    // starts again from there instead of the difference wrapping around
+    if (!g_SnapshotProfileStarted || nextEntities < g_SnapshotProfile.lastNextEntities || nextCachedEntities < g_SnapshotProfile.lastNextCachedEntities)
+    {
+        g_SnapshotProfile.lastNextEntities = nextEntities;
+        g_SnapshotProfile.lastNextCachedEntities = nextCachedEntities;
+        g_SnapshotProfileStarted = true;
+        return TASK_DONE;
+    }
+
+    uint32_t bufferSize = static_cast<uint32_t>(svsHeader->numSnapshotEntities);
+    uint32_t slots = static_cast<uint32_t>(nextEntities - g_SnapshotProfile.lastNextEntities);
+    uint32_t cachedSlots = static_cast<uint32_t>(nextCachedEntities - g_SnapshotProfile.lastNextCachedEntities);
+
+    // Anything older than a full buffer was already overwritten
+    if (slots > bufferSize)
+        slots = bufferSize;
+
+    uint16_t runLengths[MAX_CLIENTS];
+    size_t runCount = 0;
+    bool tooManyRuns = false;
+    int previousNumber = MAX_GENTITIES;
+    uint32_t start = static_cast<uint32_t>(nextEntities) - slots;
+
+    for (uint32_t i = 0; i < slots; i++)
+    {
+        const entityState_s *pState = &svsHeader->snapshotEntities[(start + i) % bufferSize];
+        int number = pState->number;
+        int type = pState->eType < SNAPSHOT_ENTITY_TYPES ? pState->eType : SNAPSHOT_ENTITY_TYPES - 1;
+
+        if (number >= 0 && number < MAX_GENTITIES)
+            g_SnapshotProfile.entitySlots[number]++;
+
+        if (type >= 0)
+            g_SnapshotProfile.typeSlots[type]++;
+
+        if (number <= previousNumber)
+        {
+            if (runCount == MAX_CLIENTS)
+                tooManyRuns = true;
+            else
+                runLengths[runCount++] = 0;
+        }
+
+        runLengths[runCount - 1]++;
+        previousNumber = number;
+    }
+
+    if (!tooManyRuns)
+        AttributeSnapshotClients(runLengths, runCount);
+    else
+        g_SnapshotProfile.unattributedFrames++;
+
+    g_SnapshotProfile.frames++;
+    g_SnapshotProfile.totalSlots += slots;
+
+    if (slots > g_SnapshotProfile.maxSlotsPerFrame)
+        g_SnapshotProfile.maxSlotsPerFrame = slots;
+
+    if (cachedSlots > g_SnapshotProfile.maxCachedSlotsPerFrame)
+        g_SnapshotProfile.maxCachedSlotsPerFrame = cachedSlots;
+
+    g_SnapshotProfile.lastNextEntities = nextEntities;
+    g_SnapshotProfile.lastNextCachedEntities = nextCachedEntities;
+
+    return TASK_DONE;
+}
+
+// Writes the indices of the largest counts to pTop, largest first, and returns how many there are
+size_t SelectTopCounts(const uint32_t *pCounts, size_t count, int *pTop, size_t topCount)
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (pCounts[i] == 0)
+            continue;
+
+        size_t position = found < topCount ? found++ : topCount;
+        while (position > 0 && pCounts[pTop[position - 1]] < pCounts[i])
+        {
+            if (position < topCount)
+                pTop[position] = pTop[position - 1];
+            position--;
+        }
+
+        if (position < topCount)
+            pTop[position] = static_cast<int>(i);
+    }
+
+    return found;
+}
+
+void PrintTopSnapshotSlots(int clientNum, const char *label, const uint32_t *pCounts, size_t count)
+{
+    int top[SNAPSHOT_PROFILE_TOP_COUNT];
+    size_t found = SelectTopCounts(pCounts, count, top, SNAPSHOT_PROFILE_TOP_COUNT);
+    uint64_t totalSlots = g_SnapshotProfile.totalSlots != 0 ? g_SnapshotProfile.totalSlots : 1;
+
+    for (size_t i = 0; i < found; i++)
+    {
+        PrintToClient(
+            clientNum,
+            "  %s %d: %u slots (%u%%)",
+            label,
+            top[i],
+            pCounts[top[i]],
+            static_cast<uint32_t>(pCounts[top[i]] * 100ull / totalSlots)
+        );
+    }
+}
+
+void Cmd_SnapshotProfile_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    char argument[32];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    if (I_strnicmp(argument, "reset", 5) == 0)
+    {
+        ResetSnapshotProfile();
+        PrintToClient(clientNum, "snapshotprofile: reset");
+        return;
+    }
+
+    // A delta snapshot needs the entities of a snapshot up to PACKET_BACKUP frames old to still be there
+    uint32_t bufferSize = static_cast<uint32_t>(svsHeader->numSnapshotEntities);
+    uint32_t averageSlots = g_SnapshotProfile.frames != 0 ? static_cast<uint32_t>(g_SnapshotProfile.totalSlots / g_SnapshotProfile.frames) : 0;
+    uint32_t peakUsage = bufferSize != 0 ? g_SnapshotProfile.maxSlotsPerFrame * SNAPSHOT_PACKET_BACKUP * 100 / bufferSize : 0;
+
+    PrintToClient(
+        clientNum,
+        "snapshotprofile: %u frames, %u entity slots, %u per frame (peak %u, %u%% of the buffer over %u frames), cached peak %u",
+        g_SnapshotProfile.frames,
+        bufferSize,
+        averageSlots,
+        g_SnapshotProfile.maxSlotsPerFrame,
+        peakUsage,
+        SNAPSHOT_PACKET_BACKUP,
+        g_SnapshotProfile.maxCachedSlotsPerFrame
+    );
+
+    PrintTopSnapshotSlots(clientNum, "entity", g_SnapshotProfile.entitySlots, MAX_GENTITIES);
+    PrintTopSnapshotSlots(clientNum, "type", g_SnapshotProfile.typeSlots, SNAPSHOT_ENTITY_TYPES);
+
+    // Per-client counts come from AttributeSnapshotClients and are only estimates
+    PrintToClient(
+        clientNum,
+        "  clients estimated in %u frames, not in %u (rate-skipped clients and merged snapshots can misattribute)",
+        g_SnapshotProfile.attributedFrames,
+        g_SnapshotProfile.unattributedFrames
+    );
+    PrintTopSnapshotSlots(clientNum, "client", g_SnapshotProfile.clientSlots, MAX_CLIENTS);
+}
+
+#define MAX_ENTITY_GROUPS 32
+#define ENTITY_GROUP_NAME_LENGTH 32
+#define QUERY_ANY_TEAM -1
+
+// Named sets of entities, for scripts that keep an array of entities only to search it by
+// distance. A freed entity leaves every group it was in
+struct EntityGroup
+{
+    uint32_t hash; // 0 for an unused group
+    int count;
+    char name[ENTITY_GROUP_NAME_LENGTH];
+    uint32_t bits[MAX_GENTITIES / 32];
+};
+
+struct DistanceCandidate
+{
+    float distanceSquared;
+    int entnum;
+};
+
+inline bool operator<(const DistanceCandidate &left, const DistanceCandidate &right)
+{
+    return left.distanceSquared < right.distanceSquared;
+}
+
+// Result of the last sort, read back one entity at a time by getsortedentity. It's dropped at
+// the start of every frame, entities freed before then are replaced by -1
+struct DistanceQuery
+{
+    int count;
+    DistanceCandidate candidates[MAX_GENTITIES];
+};
+
+struct DistanceQueryStats
+{
+    uint32_t sorts;
+    uint32_t closest;
+    uint32_t candidates;
+    uint32_t fullGroups;
+};
+
+EntityGroup g_EntityGroups[MAX_ENTITY_GROUPS];
+uint32_t g_EntityGroupMemberships[MAX_GENTITIES]; // Bit n is set for group n
+DistanceQuery g_DistanceQuery;
+DistanceQueryStats g_DistanceQueryStats;
+
+void ResetDistanceQuery()
+{
+    g_DistanceQuery.count = 0;
+}
+
+// Keeps the other results at their place so a script reading them in order isn't thrown off
+void DropFromDistanceQuery(int entnum)
+{
+    for (int i = 0; i < g_DistanceQuery.count; i++)
+    {
+        if (g_DistanceQuery.candidates[i].entnum == entnum)
+            g_DistanceQuery.candidates[i].entnum = -1;
+    }
+}
+
+// Groups refer to entities of the previous level
+void InitEntityGroups()
+{
+    memset(g_EntityGroups, 0, sizeof(g_EntityGroups));
+    memset(g_EntityGroupMemberships, 0, sizeof(g_EntityGroupMemberships));
+    ResetDistanceQuery();
+}
+
+// Returns nullptr if there's no such group and it isn't created, or every group is used
+EntityGroup *FindEntityGroup(const char *name, bool create)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length >= ENTITY_GROUP_NAME_LENGTH)
+        return nullptr;
+
+    uint32_t hash = HashNameNoCase(name, length);
+    EntityGroup *pFree = nullptr;
+
+    for (int i = 0; i < MAX_ENTITY_GROUPS; i++)
+    {
+        EntityGroup *pGroup = &g_EntityGroups[i];
+        if (pGroup->hash == hash && I_strnicmp(pGroup->name, name, ENTITY_GROUP_NAME_LENGTH) == 0)
+            return pGroup;
+        if (pGroup->hash == 0 && !pFree)
+            pFree = pGroup;
+    }
+
+    if (!create || !pFree)
+        return nullptr;
+
+    pFree->hash = hash;
+    pFree->count = 0;
+    strncpy_s(pFree->name, sizeof(pFree->name), name, _TRUNCATE);
+    memset(pFree->bits, 0, sizeof(pFree->bits));
+    return pFree;
+}
+
+void RemoveFromEntityGroup(EntityGroup *pGroup, int entnum)
+{
+    if (!IsEntityBitSet(pGroup->bits, entnum))
+        return;
+
+    ClearEntityBit(pGroup->bits, entnum);
+    g_EntityGroupMemberships[entnum] &= ~(1u << (pGroup - g_EntityGroups));
+
+    // An empty group frees its slot for another name
+    if (--pGroup->count == 0)
+        pGroup->hash = 0;
+}
+
+void RemoveFromEntityGroups(int entnum)
+{
+    uint32_t memberships = g_EntityGroupMemberships[entnum];
+
+    while (memberships != 0)
+    {
+        uint32_t group = 31 - CountLeadingZeros(memberships);
+        memberships &= ~(1u << group);
+        RemoveFromEntityGroup(&g_EntityGroups[group], entnum);
+    }
+}
+
+// Writes QUERY_ANY_TEAM for "any", returns false after raising a script error for an unknown team
+bool Scr_GetQueryTeam(unsigned int index, int *pTeam)
+{
+    const char *name = Scr_GetString(index);
+    if (std::strcmp(name, "any") == 0)
+    {
+        *pTeam = QUERY_ANY_TEAM;
+        return true;
+    }
+
+    *pTeam = GetTeamFromName(name);
+    if (*pTeam == -1)
+    {
+        Scr_ObjectError("unknown team\n");
+        return false;
+    }
+
+    return true;
+}
+
+const uint32_t *GetQueryClientBits(int team)
+{
+    return team == QUERY_ANY_TEAM ? g_ClientStore.inGameBits : g_ClientStore.teamBits[team];
+}
+
+EntityGroup *Scr_GetEntityGroup(unsigned int index)
+{
+    EntityGroup *pGroup = FindEntityGroup(Scr_GetString(index), false);
+    if (!pGroup)
+        Scr_ObjectError("unknown entity group\n");
+
+    return pGroup;
+}
+
+void SetDistanceCandidate(DistanceCandidate *pCandidate, int entnum, const float *origin)
+{
+    const float *position = GetEntityAtIndex(entnum)->r.currentOrigin;
+    float x = position[0] - origin[0];
+    float y = position[1] - origin[1];
+    float z = position[2] - origin[2];
+
+    pCandidate->distanceSquared = x * x + y * y + z * z;
+    pCandidate->entnum = entnum;
+}
+
+// Writes the players of the team, or the entities of the group when pGroup is set, to
+// pCandidates which needs room for MAX_GENTITIES. Returns how many were written
+int CollectDistanceCandidates(const EntityGroup *pGroup, int team, const float *origin, DistanceCandidate *pCandidates)
+{
+    int count = 0;
+
+    if (!pGroup)
+    {
+        ClientBitIterator iterator(GetQueryClientBits(team));
+        for (int clientNum = iterator.Next(); clientNum != -1; clientNum = iterator.Next())
+            SetDistanceCandidate(&pCandidates[count++], clientNum, origin);
+    }
+    else
+    {
+        for (int word = 0; word < MAX_GENTITIES / 32; word++)
+        {
+            uint32_t bits = pGroup->bits[word];
+            while (bits != 0)
+            {
+                uint32_t bit = 31 - CountLeadingZeros(bits);
+                bits &= ~(1u << bit);
+                SetDistanceCandidate(&pCandidates[count++], (word << 5) + bit, origin);
+            }
+        }
+    }
+
+    g_DistanceQueryStats.candidates += count;
+    return count;
+}
+
+// Replaces the sorted result with the closest count candidates, 0 for all of them. Selecting
+// them first makes it linear in the number of candidates plus count log count, instead of
+// sorting all of them
+int SortDistanceCandidates(const EntityGroup *pGroup, int team, const float *origin, int count)
+{
+    DistanceCandidate *pBegin = g_DistanceQuery.candidates;
+    g_DistanceQuery.count = CollectDistanceCandidates(pGroup, team, origin, pBegin);
+    DistanceCandidate *pEnd = pBegin + g_DistanceQuery.count;
+
+    if (count > 0 && count < g_DistanceQuery.count)
+    {
+        std::nth_element(pBegin, pBegin + count, pEnd);
+        g_DistanceQuery.count = count;
+        pEnd = pBegin + count;
+    }
+
+    std::sort(pBegin, pEnd);
+    g_DistanceQueryStats.sorts++;
+    return g_DistanceQuery.count;
+}
+
+// Returns the entity number of the closest candidate or -1, the sorted result is left alone
+int FindClosestCandidate(const EntityGroup *pGroup, int team, const float *origin)
+{
+    size_t scratchPosition = g_FrameArena.GetPosition();
+    DistanceCandidate *pCandidates = g_FrameArena.AllocateArray<DistanceCandidate>(MAX_GENTITIES);
+    if (pCandidates == nullptr)
+        return -1;
+
+    int count = CollectDistanceCandidates(pGroup, team, origin, pCandidates);
+    int entnum = count > 0 ? std::min_element(pCandidates, pCandidates + count)->entnum : -1;
+
+    g_FrameArena.Rewind(scratchPosition);
+    g_DistanceQueryStats.closest++;
+    return entnum;
+}
+
+// Params are the origin, the team or "any" and how many of the closest players to keep, 0 for
+// all of them. Returns how many were sorted, read them with getsortedentity
+void GScr_SortPlayersByDistance(scr_entref_t entref)
+{
+    TRACE_SPAN("sortplayersbydistance");
+    float origin[3];
+    Scr_GetVector(0, origin);
+
+    int team;
+    if (!Scr_GetQueryTeam(1, &team))
+        return;
+
+    Scr_AddInt(SortDistanceCandidates(nullptr, team, origin, Scr_GetInt(2)));
+}
+
+// Params are the group, the origin and how many of the closest entities to keep, 0 for all
+void GScr_SortEntityGroupByDistance(scr_entref_t entref)
+{
+    TRACE_SPAN("sortentitygroupbydistance");
+    EntityGroup *pGroup = Scr_GetEntityGroup(0);
+    if (!pGroup)
+        return;
+
+    float origin[3];
+    Scr_GetVector(1, origin);
+
+    Scr_AddInt(SortDistanceCandidates(pGroup, QUERY_ANY_TEAM, origin, Scr_GetInt(2)));
+}
+
+// Param is the place in the last sort starting at 0. Returns the entity number, or -1 past the
+// end or for an entity freed since. The result is only valid until the next sort, in the same frame
+void GScr_GetSortedEntity(scr_entref_t entref)
+{
+    int index = Scr_GetInt(0);
+    Scr_AddInt(index >= 0 && index < g_DistanceQuery.count ? g_DistanceQuery.candidates[index].entnum : -1);
+}
+
+// Params are the origin and the team or "any", returns the closest player's entity number or -1
+void GScr_GetClosestPlayer(scr_entref_t entref)
+{
+    float origin[3];
+    Scr_GetVector(0, origin);
+
+    int team;
+    if (!Scr_GetQueryTeam(1, &team))
+        return;
+
+    Scr_AddInt(FindClosestCandidate(nullptr, team, origin));
+}
+
+// Params are the group and the origin
+void GScr_GetClosestInEntityGroup(scr_entref_t entref)
+{
+    EntityGroup *pGroup = Scr_GetEntityGroup(0);
+    if (!pGroup)
+        return;
+
+    float origin[3];
+    Scr_GetVector(1, origin);
+
+    Scr_AddInt(FindClosestCandidate(pGroup, QUERY_ANY_TEAM, origin));
+}
+
+// Params are the team and 0 for clients 0 to 31 or 1 for 32 to 63
+void GScr_GetTeamClientMask(scr_entref_t entref)
+{
+    int team;
+    if (!Scr_GetQueryTeam(0, &team))
+        return;
+
+    int word = Scr_GetInt(1);
+    Scr_AddInt(word >= 0 && word < CLIENT_BIT_WORDS ? static_cast<int>(GetQueryClientBits(team)[word]) : 0);
+}
+
+// Returns false if every group is used
+void GScr_AddToEntityGroup(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("not an entity\n");
+        return;
+    }
+
+    const char *name = Scr_GetString(0);
+    if (strlen(name) == 0 || strlen(name) >= ENTITY_GROUP_NAME_LENGTH)
+    {
+        Scr_ObjectError("bad entity group name\n");
+        return;
+    }
+
+    EntityGroup *pGroup = FindEntityGroup(name, true);
+    if (!pGroup)
+    {
+        g_DistanceQueryStats.fullGroups++;
+        Scr_AddBool(false);
+        return;
+    }
+
+    if (!IsEntityBitSet(pGroup->bits, entref.entnum))
+    {
+        SetEntityBit(pGroup->bits, entref.entnum);
+        g_EntityGroupMemberships[entref.entnum] |= 1u << (pGroup - g_EntityGroups);
+        pGroup->count++;
+    }
+
+    Scr_AddBool(true);
+}
+
+void GScr_RemoveFromEntityGroup(scr_entref_t entref)
+{
+    EntityGroup *pGroup = FindEntityGroup(Scr_GetString(0), false);
+    if (pGroup && entref.entnum < MAX_GENTITIES)
+        RemoveFromEntityGroup(pGroup, entref.entnum);
+}
+
+void GScr_GetEntityGroupCount(scr_entref_t entref)
+{
+    EntityGroup *pGroup = FindEntityGroup(Scr_GetString(0), false);
+    Scr_AddInt(pGroup ? pGroup->count : 0);
+}
+
+void Cmd_EntityGroups_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "entitygroups: %u sorts, %u closest, %u candidates, %u adds to full groups",
+        g_DistanceQueryStats.sorts,
+        g_DistanceQueryStats.closest,
+        g_DistanceQueryStats.candidates,
+        g_DistanceQueryStats.fullGroups
+    );
 
-    // // Arguments checks.
-    // gentity_t* brushEnt = Scr_GetEntity(0);
-    // if (brushEnt->classname != (unsigned short)scr_const.script_brushmodel && brushEnt->classname != (unsigned short)scr_const.script_model && brushEnt->classname != (unsigned short)scr_const.script_origin && brushEnt->classname != (unsigned short)scr_const.light)
-    //     Scr_ParamError(0, "brush model entity classname must be one of {script_brushmodel, script_model, script_origin, light}");
+    for (int i = 0; i < MAX_ENTITY_GROUPS; i++)
+    {
+        const EntityGroup *pGroup = &g_EntityGroups[i];
+        if (pGroup->hash != 0)
+            PrintToClient(clientNum, "  %s: %d entities", pGroup->name, pGroup->count);
+    }
+}
 
-    // if (!brushEnt->s.index)
-    //     Scr_ParamError(0, "brush model entity has no collision model");
+enum EntityPoolState
+{
+    ENTITY_POOL_NONE,
+    ENTITY_POOL_FREE,
+    ENTITY_POOL_ALLOCATED,
+};
 
-    gentity_s *scriptEnt = GetEntity(entref);
-    gentity_s *brushEnt = Scr_GetEntity(0);
+struct EntityPoolStats
+{
+    uint32_t allocations;
+    uint32_t allocationFailures;
+    uint32_t allocatedHighWater;
+    uint32_t entityFrees;
+    int numEntitiesHighWater;
+};
 
-    // mp_backlot scriptEntIndex: 8 == cube
+// Entities scripts spawned up front and handed to the pool. Free ones are kept in an
+// intrusive doubly linked list indexed by entity number so taking one, returning one or
+// dropping one the engine freed behind our back is O(1)
+uint8_t g_EntityPoolState[MAX_GENTITIES];
+int16_t g_EntityPoolNext[MAX_GENTITIES];
+int16_t g_EntityPoolPrevious[MAX_GENTITIES];
+int g_EntityPoolHead = -1;
+uint32_t g_EntityPoolSize = 0;
+uint32_t g_EntityPoolAllocated = 0;
+EntityPoolStats g_EntityPoolStats;
+
+void InitEntityPool()
+{
+    memset(g_EntityPoolState, ENTITY_POOL_NONE, sizeof(g_EntityPoolState));
+    g_EntityPoolHead = -1;
+    g_EntityPoolSize = 0;
+    g_EntityPoolAllocated = 0;
+    memset(&g_EntityPoolStats, 0, sizeof(g_EntityPoolStats));
+}
 
-    SV_UnlinkEntity(scriptEnt);
-    scriptEnt->s.index = brushEnt->s.index;
-    int contents = scriptEnt->r.contents;
-    SV_SetBrushModel(scriptEnt);
-    scriptEnt->r.contents |= contents;
-    SV_LinkEntity(scriptEnt);
+void PushFreePooledEntity(int entityNum)
+{
+    g_EntityPoolState[entityNum] = ENTITY_POOL_FREE;
+    g_EntityPoolPrevious[entityNum] = -1;
+    g_EntityPoolNext[entityNum] = static_cast<int16_t>(g_EntityPoolHead);
+
+    if (g_EntityPoolHead != -1)
+        g_EntityPoolPrevious[g_EntityPoolHead] = static_cast<int16_t>(entityNum);
+
+    g_EntityPoolHead = entityNum;
+}
+
+void UnlinkFreePooledEntity(int entityNum)
+{
+    int previous = g_EntityPoolPrevious[entityNum];
+    int next = g_EntityPoolNext[entityNum];
+
+    if (previous != -1)
+        g_EntityPoolNext[previous] = static_cast<int16_t>(next);
+    else
+        g_EntityPoolHead = next;
+
+    if (next != -1)
+        g_EntityPoolPrevious[next] = static_cast<int16_t>(previous);
+}
+
+// Drop the entity from the pool whatever state it's in
+void RemovePooledEntity(int entityNum)
+{
+    switch (g_EntityPoolState[entityNum])
+    {
+    case ENTITY_POOL_FREE:
+        UnlinkFreePooledEntity(entityNum);
+        break;
+    case ENTITY_POOL_ALLOCATED:
+        g_EntityPoolAllocated--;
+        break;
+    default:
+        return;
+    }
+
+    g_EntityPoolState[entityNum] = ENTITY_POOL_NONE;
+    g_EntityPoolSize--;
+}
+
+// Takes a free entity from the pool and puts it back in the world, returns -1 if the pool
+// is empty
+int AllocPooledEntity()
+{
+    int entityNum = g_EntityPoolHead;
+    if (entityNum == -1)
+    {
+        g_EntityPoolStats.allocationFailures++;
+        return -1;
+    }
+
+    UnlinkFreePooledEntity(entityNum);
+    g_EntityPoolState[entityNum] = ENTITY_POOL_ALLOCATED;
+    g_EntityPoolAllocated++;
+    g_EntityPoolStats.allocations++;
+
+    if (g_EntityPoolAllocated > g_EntityPoolStats.allocatedHighWater)
+        g_EntityPoolStats.allocatedHighWater = g_EntityPoolAllocated;
+
+    SV_LinkEntity(GetEntityAtIndex(entityNum));
+    return entityNum;
+}
+
+// Takes the entity out of the world and makes it available again, unlinked entities
+// aren't sent to clients
+void FreePooledEntity(int entityNum)
+{
+    SV_UnlinkEntity(GetEntityAtIndex(entityNum));
+    g_EntityPoolAllocated--;
+    PushFreePooledEntity(entityNum);
+}
+
+TaskResult Task_SampleEntityCount(Task *pTask)
+{
+    if (level->num_entities > g_EntityPoolStats.numEntitiesHighWater)
+        g_EntityPoolStats.numEntitiesHighWater = level->num_entities;
+
+    return TASK_DONE;
+}
+
+Detour *pG_FreeEntityDetour = nullptr;
+
+void G_FreeEntityHook(gentity_s *ent)
+{
+    // A pooled or queued entity deleted by a script or the engine must not be touched anymore
+    int entityNum = ent->s.number;
+    if (entityNum >= 0 && entityNum < MAX_GENTITIES)
+    {
+        RemovePooledEntity(entityNum);
+        g_BrushModelCloneQueued[entityNum] = false;
+        ClearEntityBit(g_DeferredLinkEntities, entityNum);
+        ClearEntityBit(g_PendingLinkEntities, entityNum);
+        RemoveNativeMover(entityNum);
+        RemoveCulledEntity(entityNum, false);
+        RemoveFromEntityGroups(entityNum);
+        DropFromDistanceQuery(entityNum);
+    }
+
+    g_EntityPoolStats.entityFrees++;
+
+    pG_FreeEntityDetour->GetOriginal<decltype(&G_FreeEntityHook)>()(ent);
+}
+
+void GScr_AddToEntityPool(scr_entref_t entref)
+{
+    if (entref.entnum < MAX_CLIENTS || entref.entnum >= MAX_GENTITIES)
+    {
+        Scr_ObjectError("only non-client entities can be pooled\n");
+        return;
+    }
+
+    if (g_EntityPoolState[entref.entnum] != ENTITY_POOL_NONE)
+        return;
+
+    SV_UnlinkEntity(GetEntityAtIndex(entref.entnum));
+    g_EntityPoolSize++;
+    PushFreePooledEntity(entref.entnum);
+}
+
+// todo: find address for Scr_AddEntity. Until then only the entity number is returned and
+// scripts map it back to the entity themselves, see the entity pool section of the README
+void GScr_AllocPooledEntity(scr_entref_t entref)
+{
+    TRACE_SPAN("allocpooledentity");
+    Scr_AddInt(AllocPooledEntity());
+}
+
+void GScr_FreePooledEntity(scr_entref_t entref)
+{
+    if (entref.entnum >= MAX_GENTITIES || g_EntityPoolState[entref.entnum] != ENTITY_POOL_ALLOCATED)
+    {
+        Scr_ObjectError("entity wasn't allocated from the entity pool\n");
+        return;
+    }
+
+    FreePooledEntity(entref.entnum);
+}
+
+void GScr_GetEntityPoolFreeCount(scr_entref_t entref)
+{
+    Scr_AddInt(g_EntityPoolSize - g_EntityPoolAllocated);
+}
+
+void Cmd_EntityPool_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    PrintToClient(
+        clientNum,
+        "entitypool: %u pooled, %u allocated (peak %u), %u allocations, %u failures, %u frees, num_entities %d (peak %d)",
+        g_EntityPoolSize,
+        g_EntityPoolAllocated,
+        g_EntityPoolStats.allocatedHighWater,
+        g_EntityPoolStats.allocations,
+        g_EntityPoolStats.allocationFailures,
+        g_EntityPoolStats.entityFrees,
+        level->num_entities,
+        g_EntityPoolStats.numEntitiesHighWater
+    );
+}
+
+#define METRICS_PUBLISH_FRAMES 20 // Once a second
+
+struct MetricsPublisher
+{
+    bool enabled;
+    bool networkStarted;
+    SOCKET socket;
+    sockaddr_in destination;
+    uint32_t sequence;
+    uint32_t sent;
+    uint32_t failures;
+};
+
+// The packet is filled and encoded in place every time, publishing never allocates
+MetricsPublisher g_Metrics = { false, false, INVALID_SOCKET };
+MetricsPacket g_MetricsPacket;
+uint8_t g_MetricsBuffer[sizeof(MetricsPacket)];
+
+void FillPhaseMetrics(int phase, uint32_t *pP50, uint32_t *pP99, uint32_t *pMax)
+{
+    LogHistogram histogram;
+    GetPhaseWindow(phase, &histogram);
+
+    *pP50 = histogram.GetPercentile(50);
+    *pP99 = histogram.GetPercentile(99);
+    *pMax = histogram.GetMax();
+}
+
+void FillMetricsPacket(MetricsPacket *pPacket)
+{
+    pPacket->magic = METRICS_MAGIC;
+    pPacket->version = METRICS_VERSION;
+    pPacket->fieldCount = METRICS_FIELD_COUNT;
+    pPacket->sequence = g_Metrics.sequence++;
+    pPacket->serverTime = static_cast<uint32_t>(svsHeader->time);
+
+    pPacket->frames = g_FrameIntervals.GetCount();
+    pPacket->frameIntervalP50 = g_FrameIntervals.GetPercentile(50);
+    pPacket->frameIntervalP99 = g_FrameIntervals.GetPercentile(99);
+    pPacket->frameIntervalMax = g_FrameIntervals.GetMax();
+    pPacket->frameSpikes = g_PhaseProfiler.spikes;
+    pPacket->schedulerUs = static_cast<uint32_t>(TimeBaseToUs(g_Scheduler.GetLastFrameTicks()));
+    pPacket->schedulerOverBudgetFrames = g_Scheduler.GetOverBudgetFrames();
+
+    FillPhaseMetrics(PHASE_PLUGIN_FRAME, &pPacket->pluginFrameP50Us, &pPacket->pluginFrameP99Us, &pPacket->pluginFrameMaxUs);
+    FillPhaseMetrics(PHASE_CLIENT_THINK, &pPacket->clientThinkP50Us, &pPacket->clientThinkP99Us, &pPacket->clientThinkMaxUs);
+    FillPhaseMetrics(PHASE_CLIENT_COMMAND, &pPacket->clientCommandP50Us, &pPacket->clientCommandP99Us, &pPacket->clientCommandMaxUs);
+    FillPhaseMetrics(PHASE_LINK_ENTITY, &pPacket->linkEntityP50Us, &pPacket->linkEntityP99Us, &pPacket->linkEntityMaxUs);
+
+    pPacket->connectedClients = CountClientBits(g_ClientStore.connectedBits);
+    pPacket->inGameClients = CountClientBits(g_ClientStore.inGameBits);
+    pPacket->netchanDropped = 0;
+    pPacket->commandsDropped = 0;
+    pPacket->commandsDuplicated = 0;
+    pPacket->worstCommandAgeP99 = 0;
+
+    ClientBitIterator iterator(g_ClientStore.connectedBits);
+    for (int i = iterator.Next(); i != -1; i = iterator.Next())
+    {
+        const ClientLatency *pLatency = &g_ClientLatencies[i];
+        uint32_t ageP99 = pLatency->age.GetPercentile(99);
+
+        pPacket->netchanDropped += static_cast<uint32_t>(GetClientAtIndex(i)->header.netchan.dropped);
+        pPacket->commandsDropped += pLatency->dropped;
+        pPacket->commandsDuplicated += pLatency->duplicated;
+        if (ageP99 > pPacket->worstCommandAgeP99)
+            pPacket->worstCommandAgeP99 = ageP99;
+    }
+
+    pPacket->entities = static_cast<uint32_t>(level->num_entities);
+    pPacket->pooledEntities = g_EntityPoolSize;
+    pPacket->pooledEntitiesAllocated = g_EntityPoolAllocated;
+    pPacket->nativeMovers = static_cast<uint32_t>(g_NativeMoverCount);
+    pPacket->culledEntities = static_cast<uint32_t>(g_CulledEntityCount);
+    pPacket->deferredLinks = g_DeferredLinkStats.deferred;
+    pPacket->flushedLinks = g_DeferredLinkStats.flushed;
+
+    pPacket->pluginArenaBytes = static_cast<uint32_t>(g_PluginArena.GetUsedBytes());
+    pPacket->frameArenaPeakBytes = static_cast<uint32_t>(g_FrameArena.GetPeakBytes());
+    pPacket->commandLookups = g_CommandIndexStats.lookups;
+    pPacket->logDropped = g_Logger.GetDroppedCount();
+    pPacket->traceEvents = g_Tracer.GetEventCount();
+}
+
+TaskResult Task_PublishMetrics(Task *pTask)
+{
+    if (!g_Metrics.enabled)
+        return TASK_DONE;
+
+    FillMetricsPacket(&g_MetricsPacket);
+    EncodeMetricsPacket(&g_MetricsPacket, g_MetricsBuffer);
+
+    // The socket doesn't block, a datagram that can't be sent right away is dropped
+    int sent = sendto(
+        g_Metrics.socket,
+        reinterpret_cast<const char *>(g_MetricsBuffer),
+        sizeof(g_MetricsBuffer),
+        0,
+        reinterpret_cast<const sockaddr *>(&g_Metrics.destination),
+        sizeof(g_Metrics.destination)
+    );
+
+    if (sent == sizeof(g_MetricsBuffer))
+        g_Metrics.sent++;
+    else
+        g_Metrics.failures++;
+
+    return TASK_DONE;
+}
+
+// The title already started the network stack, starting it again only adds a reference. Plain
+// UDP needs the security bypass, which only has an effect on development and modified consoles
+bool StartMetricsNetwork()
+{
+    if (g_Metrics.networkStarted)
+        return true;
+
+    XNetStartupParams params;
+    memset(&params, 0, sizeof(params));
+    params.cfgSizeOfStruct = sizeof(params);
+    params.cfgFlags = XNET_STARTUP_BYPASS_SECURITY;
+    XNetStartup(&params);
+
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        return false;
+
+    g_Metrics.networkStarted = true;
+    return true;
+}
+
+bool OpenMetricsSocket(uint32_t address, uint16_t port)
+{
+    if (!StartMetricsNetwork())
+        return false;
+
+    if (g_Metrics.socket == INVALID_SOCKET)
+    {
+        g_Metrics.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (g_Metrics.socket == INVALID_SOCKET)
+            return false;
+
+        u_long nonBlocking = 1;
+        ioctlsocket(g_Metrics.socket, FIONBIO, &nonBlocking);
+    }
+
+    memset(&g_Metrics.destination, 0, sizeof(g_Metrics.destination));
+    g_Metrics.destination.sin_family = AF_INET;
+    g_Metrics.destination.sin_addr.s_addr = address;
+    g_Metrics.destination.sin_port = htons(port);
+    g_Metrics.enabled = true;
+
+    return true;
+}
+
+void CloseMetricsSocket()
+{
+    g_Metrics.enabled = false;
+
+    if (g_Metrics.socket != INVALID_SOCKET)
+    {
+        closesocket(g_Metrics.socket);
+        g_Metrics.socket = INVALID_SOCKET;
+    }
+
+    if (g_Metrics.networkStarted)
+    {
+        WSACleanup();
+        g_Metrics.networkStarted = false;
+    }
+}
+
+// Used when the title is gone, its network stack and the socket went with it
+void ForgetMetricsSocket()
+{
+    g_Metrics.enabled = false;
+    g_Metrics.socket = INVALID_SOCKET;
+    g_Metrics.networkStarted = false;
+}
+
+// metrics <ip> [port] starts publishing to the address, metrics off stops. Only the host can
+// use it, otherwise any player could make the console send packets to any address
+void Cmd_Metrics_f(gentity_s *ent)
+{
+    int clientNum = GetEntityNumber(ent);
+
+    if (!IsHostClient(clientNum))
+    {
+        PrintToClient(clientNum, "metrics: only the host can use this command");
+        return;
+    }
+
+    char argument[32];
+    SV_Cmd_ArgvBuffer(1, argument, sizeof(argument));
+
+    if (I_strnicmp(argument, "off", 3) == 0)
+    {
+        CloseMetricsSocket();
+        PrintToClient(clientNum, "metrics: off");
+        return;
+    }
+
+    if (argument[0] != '\0')
+    {
+        char portArgument[16];
+        SV_Cmd_ArgvBuffer(2, portArgument, sizeof(portArgument));
+
+        int port = portArgument[0] != '\0' ? atoi(portArgument) : METRICS_DEFAULT_PORT;
+        uint32_t address = inet_addr(argument);
+
+        if (address == INADDR_NONE || port <= 0 || port > 0xFFFF)
+        {
+            PrintToClient(clientNum, "metrics: usage metrics <ip> [port] or metrics off");
+            return;
+        }
+
+        if (!OpenMetricsSocket(address, static_cast<uint16_t>(port)))
+        {
+            PrintToClient(clientNum, "metrics: couldn't open a socket");
+            return;
+        }
+    }
+
+    PrintToClient(
+        clientNum,
+        "metrics: %s, %u packets of %u bytes sent, %u failed",
+        g_Metrics.enabled ? "on" : "off",
+        g_Metrics.sent,
+        static_cast<uint32_t>(sizeof(g_MetricsBuffer)),
+        g_Metrics.failures
+    );
 }
 
 Detour *pScr_GetMethodDetour = nullptr;
 
 xfunction_t Scr_GetMethodHook(const char **pName, int *type)
 {
+    TRACE_SPAN("Scr_GetMethod");
     xfunction_t ret = pScr_GetMethodDetour->GetOriginal<decltype(&Scr_GetMethodHook)>()(pName, type);
 
     if (ret)
@@ -1370,6 +6045,12 @@ xfunction_t Scr_GetMethodHook(const char **pName, int *type)
     if (std::strcmp(*pName, "executeclientcommand") == 0)
         return &GScr_ExecuteClientCommand;
 
+    if (std::strcmp(*pName, "executeclientcommands") == 0)
+        return &GScr_ExecuteClientCommands;
+
+    if (std::strcmp(*pName, "setclientdvars") == 0)
+        return &GScr_SetClientDvars;
+
     if (std::strcmp(*pName, "testfunction") == 0)
         return &GScr_testfunction;
 
@@ -1388,6 +6069,147 @@ xfunction_t Scr_GetMethodHook(const char **pName, int *type)
     if (std::strcmp(*pName, "clonebrushmodeltoscriptmodel") == 0)
         return &GScr_CloneBrushModelToScriptModel;
 
+    if (std::strcmp(*pName, "queuebrushmodelclone") == 0)
+        return &GScr_QueueBrushModelClone;
+
+    if (std::strcmp(*pName, "flushbrushmodelclones") == 0)
+        return &GScr_FlushBrushModelClones;
+
+    if (std::strcmp(*pName, "setdeferredlink") == 0)
+        return &GScr_SetDeferredLink;
+
+    if (std::strcmp(*pName, "nativemoveto") == 0)
+        return &GScr_NativeMoveLinearStop;
+
+    if (std::strcmp(*pName, "nativemoveaccelerate") == 0)
+        return &GScr_NativeMoveAccelerate;
+
+    if (std::strcmp(*pName, "nativemovedecelerate") == 0)
+        return &GScr_NativeMoveDecelerate;
+
+    if (std::strcmp(*pName, "nativemovelinear") == 0)
+        return &GScr_NativeMoveLinear;
+
+    if (std::strcmp(*pName, "nativemovesine") == 0)
+        return &GScr_NativeMoveSine;
+
+    if (std::strcmp(*pName, "nativemovestop") == 0)
+        return &GScr_NativeMoveStop;
+
+    if (std::strcmp(*pName, "isnativemoving") == 0)
+        return &GScr_IsNativeMoving;
+
+    if (std::strcmp(*pName, "istrajectorywithin") == 0)
+        return &GScr_IsTrajectoryWithin;
+
+    if (std::strcmp(*pName, "countmovingentitieswithin") == 0)
+        return &GScr_CountMovingEntitiesWithin;
+
+    if (std::strcmp(*pName, "setculldistance") == 0)
+        return &GScr_SetCullDistance;
+
+    if (std::strcmp(*pName, "setcullteam") == 0)
+        return &GScr_SetCullTeam;
+
+    if (std::strcmp(*pName, "disableculling") == 0)
+        return &GScr_DisableCulling;
+
+    if (std::strcmp(*pName, "getnextliveclient") == 0)
+        return &GScr_GetNextLiveClient;
+
+    if (std::strcmp(*pName, "getliveclientcount") == 0)
+        return &GScr_GetLiveClientCount;
+
+    if (std::strcmp(*pName, "getliveclientmask") == 0)
+        return &GScr_GetLiveClientMask;
+
+    if (std::strcmp(*pName, "getteamclientmask") == 0)
+        return &GScr_GetTeamClientMask;
+
+    if (std::strcmp(*pName, "getclosestplayer") == 0)
+        return &GScr_GetClosestPlayer;
+
+    if (std::strcmp(*pName, "sortplayersbydistance") == 0)
+        return &GScr_SortPlayersByDistance;
+
+    if (std::strcmp(*pName, "getsortedentity") == 0)
+        return &GScr_GetSortedEntity;
+
+    if (std::strcmp(*pName, "addtoentitygroup") == 0)
+        return &GScr_AddToEntityGroup;
+
+    if (std::strcmp(*pName, "removefromentitygroup") == 0)
+        return &GScr_RemoveFromEntityGroup;
+
+    if (std::strcmp(*pName, "getentitygroupcount") == 0)
+        return &GScr_GetEntityGroupCount;
+
+    if (std::strcmp(*pName, "getclosestinentitygroup") == 0)
+        return &GScr_GetClosestInEntityGroup;
+
+    if (std::strcmp(*pName, "sortentitygroupbydistance") == 0)
+        return &GScr_SortEntityGroupByDistance;
+
+    if (std::strcmp(*pName, "getinputlatency") == 0)
+        return &GScr_GetInputLatency;
+
+    if (std::strcmp(*pName, "getuserinfoint") == 0)
+        return &GScr_GetUserinfoInt;
+
+    if (std::strcmp(*pName, "hasuserinfo") == 0)
+        return &GScr_HasUserinfo;
+
+    if (std::strcmp(*pName, "userinfoequals") == 0)
+        return &GScr_UserinfoEquals;
+
+    if (std::strcmp(*pName, "getrank") == 0)
+        return &GScr_GetRank;
+
+    if (std::strcmp(*pName, "getplayeratrank") == 0)
+        return &GScr_GetPlayerAtRank;
+
+    if (std::strcmp(*pName, "getrankedplayercount") == 0)
+        return &GScr_GetRankedPlayerCount;
+
+    if (std::strcmp(*pName, "getteamtotal") == 0)
+        return &GScr_GetTeamTotal;
+
+    if (std::strcmp(*pName, "getentitychanges") == 0)
+        return &GScr_GetEntityChanges;
+
+    if (std::strcmp(*pName, "createnativehudelem") == 0)
+        return &GScr_CreateNativeHudElem;
+
+    if (std::strcmp(*pName, "destroynativehudelem") == 0)
+        return &GScr_DestroyNativeHudElem;
+
+    if (std::strcmp(*pName, "setnativehudelemposition") == 0)
+        return &GScr_SetNativeHudElemPosition;
+
+    if (std::strcmp(*pName, "setnativehudelemvalue") == 0)
+        return &GScr_SetNativeHudElemValue;
+
+    if (std::strcmp(*pName, "setnativehudelemtimer") == 0)
+        return &GScr_SetNativeHudElemTimer;
+
+    if (std::strcmp(*pName, "setnativehudelemcolor") == 0)
+        return &GScr_SetNativeHudElemColor;
+
+    if (std::strcmp(*pName, "setnativehudelemfontscale") == 0)
+        return &GScr_SetNativeHudElemFontScale;
+
+    if (std::strcmp(*pName, "addtoentitypool") == 0)
+        return &GScr_AddToEntityPool;
+
+    if (std::strcmp(*pName, "allocpooledentity") == 0)
+        return &GScr_AllocPooledEntity;
+
+    if (std::strcmp(*pName, "freepooledentity") == 0)
+        return &GScr_FreePooledEntity;
+
+    if (std::strcmp(*pName, "getentitypoolfreecount") == 0)
+        return &GScr_GetEntityPoolFreeCount;
+
     return ret;
 }
 
@@ -1395,23 +6217,91 @@ Detour *pClientCommandDetour = nullptr;
 
 void ClientCommandHook(int clientNum)
 {
-    gentity_s *ent = &g_entities[clientNum];
-    // std::cout << "ClientCommandHook clientNum: " << clientNum << std::endl;
-    // std::cout << "ClientCommandHook ent: " << ent << std::endl;
+    PhaseTimer timer(PHASE_CLIENT_COMMAND);
+    TRACE_SPAN_ARG("ClientCommand", clientNum);
+    gentity_s *ent = GetEntityAtIndex(clientNum);
 
     char cmd[1032];
     SV_Cmd_ArgvBuffer(0, cmd, 1024);
 
-    // std::cout << "ClientCommand: " << cmd << std::endl;
+    // The plugin's commands are matched by hash instead of comparing the name with each of them
+    const PluginCommand *pCommand = Cmd_FindPluginCommand(cmd);
+    if (pCommand != nullptr)
+        pCommand->function(ent);
+    else
+        pClientCommandDetour->GetOriginal<decltype(&ClientCommandHook)>()(clientNum);
+}
 
-    if (I_strnicmp(cmd, "noclip", 6) == 0)
-        Cmd_Noclip_f(ent);
+Detour *pSV_ClientThinkDetour = nullptr;
 
-    else if (I_strnicmp(cmd, "ufo", 3) == 0)
-        Cmd_UFO_f(ent);
+int g_LastFrameTime = 0;
+int g_LastNumEntities = 0;
+float g_LastMapCenter[3];
 
-    else
-        pClientCommandDetour->GetOriginal<decltype(&ClientCommandHook)>()(clientNum);
+// todo: find address for G_InitGame. Until then a new level is detected from level->num_entities
+// going down, which doesn't happen while a level runs, or from the map center moving
+bool LevelChanged()
+{
+    bool changed = level->num_entities < g_LastNumEntities || memcmp(svsHeader->mapCenter, g_LastMapCenter, sizeof(g_LastMapCenter)) != 0;
+
+    g_LastNumEntities = level->num_entities;
+    memcpy(g_LastMapCenter, svsHeader->mapCenter, sizeof(g_LastMapCenter));
+
+    return changed;
+}
+
+// Per level state refers to entities and brush models of the previous level
+void Level_Init()
+{
+    ResetEntityDiff();
+    InitEntityPool();
+    InitBrushModelClones();
+    InitDeferredLinks();
+    InitNativeMovers();
+    InitCulling();
+    InitEntityGroups();
+    ResetSnapshotProfile();
+    RebuildCommandIndex();
+}
+
+// Work that has to run once per server frame
+void Frame_Run()
+{
+    EndPhaseFrame(RecordFrameInterval());
+    PhaseTimer timer(PHASE_PLUGIN_FRAME);
+    TRACE_SPAN("plugin frame");
+
+    g_FrameArena.Reset();
+
+    if (LevelChanged())
+    {
+        TRACE_INSTANT("level change", level->num_entities);
+        Level_Init();
+    }
+
+    ResetDistanceQuery();
+    UpdateClientStore();
+
+    g_Scheduler.RunFrame();
+}
+
+void SV_ClientThinkHook(client_t *cl, usercmd_s *cmd)
+{
+    // todo: find address for SV_Frame. Until then a new server frame is detected from the first
+    // SV_ClientThink that sees svsHeader->time move. Clients send usercmds every frame so this
+    // runs once per frame while the server has players, a frame without any usercmd is folded
+    // into the next one
+    if (svsHeader->time != g_LastFrameTime)
+    {
+        g_LastFrameTime = svsHeader->time;
+        Frame_Run();
+    }
+
+    RecordUsercmd(cl, cmd);
+
+    PhaseTimer timer(PHASE_CLIENT_THINK);
+    TRACE_SPAN("client think");
+    pSV_ClientThinkDetour->GetOriginal<decltype(&SV_ClientThinkHook)>()(cl, cmd);
 }
 
 // Sets up the hook
@@ -1421,16 +6311,143 @@ void InitIW3()
     Sleep(1000);
     XNotifyQueueUI(0, 0, XNOTIFY_SYSTEM, L"iw3xenon loaded - by mo", nullptr);
 
-    pScr_GetMethodDetour = new Detour(0x822570E0, Scr_GetMethodHook);
+    InitTimeBase();
+    InitPluginMemory();
+
+    // Tasks from a previous time the game was running are stale
+    g_Scheduler.RemoveAllTasks();
+
+    InitThreadPool();
+    InitEntityDiff();
+    InitNativeHuds();
+    InitClientStore();
+    InitRankings();
+    InitUserinfos();
+    ResetLatencies();
+    InitPhaseProfiler();
+    InitEntityPool();
+    InitBrushModelClones();
+    InitDeferredLinks();
+    InitNativeMovers();
+    InitCulling();
+    InitEntityGroups();
+    ResetSnapshotProfile();
+
+    g_Scheduler.AddTask("deferred links", Task_FlushDeferredLinks, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("native movers", Task_UpdateNativeMovers, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("culling", Task_CullEntities, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("snapshot profile", Task_ProfileSnapshots, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("entity diff", Task_DiffEntities, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("native huds", Task_UpdateHuds, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("rankings", Task_UpdateRankings, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("brush model clones", Task_FlushBrushModelClones, nullptr, TASK_PRIORITY_HIGH, 1);
+    g_Scheduler.AddTask("entity count", Task_SampleEntityCount, nullptr, TASK_PRIORITY_LOW, 1);
+    g_Scheduler.AddTask("metrics", Task_PublishMetrics, nullptr, TASK_PRIORITY_LOW, METRICS_PUBLISH_FRAMES);
+
+    pScr_GetMethodDetour = CreateDetour(0x822570E0, Scr_GetMethodHook);
     pScr_GetMethodDetour->Install();
 
-    pClientCommandDetour = new Detour(0x8227DCF0, ClientCommandHook);
+    pClientCommandDetour = CreateDetour(0x8227DCF0, ClientCommandHook);
     pClientCommandDetour->Install();
 
-    Cmd_AddCommand("noclip");
-    Cmd_AddCommand("ufo");
+    pSV_ClientThinkDetour = CreateDetour(0x82208448, SV_ClientThinkHook);
+    pSV_ClientThinkDetour->Install();
+
+    pG_FreeEntityDetour = CreateDetour(0x8224BDD0, G_FreeEntityHook);
+    pG_FreeEntityDetour->Install();
+
+    pSV_LinkEntityDetour = CreateDetour(0x82355A00, SV_LinkEntityHook);
+    pSV_LinkEntityDetour->Install();
+
+    pSV_UnlinkEntityDetour = CreateDetour(0x82355F08, SV_UnlinkEntityHook);
+    pSV_UnlinkEntityDetour->Install();
+
+    Cmd_AddCommand("noclip", Cmd_Noclip_f);
+    Cmd_AddCommand("ufo", Cmd_UFO_f);
+    Cmd_AddCommand("entitydiff", Cmd_EntityDiff_f);
+    Cmd_AddCommand("hudstats", Cmd_HudStats_f);
+    Cmd_AddCommand("entitypool", Cmd_EntityPool_f);
+    Cmd_AddCommand("deferredlinks", Cmd_DeferredLinks_f);
+    Cmd_AddCommand("nativemovers", Cmd_NativeMovers_f);
+    Cmd_AddCommand("culling", Cmd_Culling_f);
+    Cmd_AddCommand("snapshotprofile", Cmd_SnapshotProfile_f);
+    Cmd_AddCommand("memory", Cmd_MemoryStats_f);
+    Cmd_AddCommand("commandindex", Cmd_CommandIndex_f);
+    Cmd_AddCommand("latency", Cmd_Latency_f);
+    Cmd_AddCommand("phaseprofile", Cmd_PhaseProfile_f);
+    Cmd_AddCommand("trace", Cmd_Trace_f);
+    Cmd_AddCommand("metrics", Cmd_Metrics_f);
+    Cmd_AddCommand("rankings", Cmd_Rankings_f);
+    Cmd_AddCommand("userinfo", Cmd_Userinfo_f);
+    Cmd_AddCommand("entitygroups", Cmd_EntityGroups_f);
+
+    // Indexes the engine's commands along with the ones just added
+    RebuildCommandIndex();
+
+    g_IW3Loaded = true;
+}
+
+void RemoveHooks()
+{
+    DestroyDetour(pScr_GetMethodDetour);
+    pScr_GetMethodDetour = nullptr;
+
+    DestroyDetour(pClientCommandDetour);
+    pClientCommandDetour = nullptr;
+
+    DestroyDetour(pSV_ClientThinkDetour);
+    pSV_ClientThinkDetour = nullptr;
+
+    DestroyDetour(pG_FreeEntityDetour);
+    pG_FreeEntityDetour = nullptr;
+
+    DestroyDetour(pSV_LinkEntityDetour);
+    pSV_LinkEntityDetour = nullptr;
+
+    DestroyDetour(pSV_UnlinkEntityDetour);
+    pSV_UnlinkEntityDetour = nullptr;
+}
+
+// Nothing is restored once the title is unloaded since its code is gone and another title may
+// be mapped at the same addresses. The hooks and commands are forgotten and their memory is
+// reused by InitPluginMemory the next time the game starts
+void ReleaseIW3()
+{
+    pScr_GetMethodDetour = nullptr;
+    pClientCommandDetour = nullptr;
+    pSV_ClientThinkDetour = nullptr;
+    pG_FreeEntityDetour = nullptr;
+    pSV_LinkEntityDetour = nullptr;
+    pSV_UnlinkEntityDetour = nullptr;
+
+    ForgetMetricsSocket();
+
+    // Queued jobs may point to memory of the title that's gone, they're dropped with the workers.
+    // A trace dump that was still queued never clears its pending flag itself
+    g_ThreadPool.Stop();
+    g_TraceDump.pending = 0;
+
+    g_DetourPool.Reset();
+    Detour::ResetStubs();
+    g_CommandPool.Reset();
+    g_pCommandTail = nullptr;
+    g_PluginCommandCount = 0;
+    memset(g_PluginCommandSlots, 0, sizeof(g_PluginCommandSlots));
+    g_IW3Loaded = false;
+}
+
+// Runs on the MonitorTitleId thread when the plugin is unloaded. Closing the socket calls into
+// the network stack, which must not happen under the loader lock DllMain holds
+void ShutdownPlugin()
+{
+    g_ThreadPool.Stop();
+
+    if (g_IW3Loaded)
+        CloseMetricsSocket();
 }
 
+#define MONITOR_STOP_TIMEOUT_MS 1000
+
 int DllMain(HANDLE hModule, DWORD reason, void *pReserved)
 {
     switch (reason)
@@ -1438,18 +6455,26 @@ int DllMain(HANDLE hModule, DWORD reason, void *pReserved)
     case DLL_PROCESS_ATTACH:
         // Runs MonitorTitleId in separate thread
         ExCreateThread(nullptr, 0, nullptr, nullptr, reinterpret_cast<PTHREAD_START_ROUTINE>(MonitorTitleId), nullptr, 2);
+
+        // Runs the log drainer in separate thread too
+        ExCreateThread(nullptr, 0, nullptr, nullptr, reinterpret_cast<PTHREAD_START_ROUTINE>(DrainLog), nullptr, 2);
         break;
     case DLL_PROCESS_DETACH:
         g_Running = false;
 
-        if (pScr_GetMethodDetour)
-            delete pScr_GetMethodDetour;
+        // MonitorTitleId stops the pool workers, waiting for threads here could deadlock
+        for (uint32_t waited = 0; !g_MonitorStopped && waited < MONITOR_STOP_TIMEOUT_MS; waited += 10)
+            Sleep(10);
+
+        // The game keeps running without the plugin, the commands it points to must go
+        if (g_IW3Loaded)
+            Cmd_RemoveCommands();
 
-        if (pClientCommandDetour)
-            delete pClientCommandDetour;
+        RemoveHooks();
 
-        // We give the system some time to clean up the thread before exiting
-        Sleep(250);
+        // DrainLog writes what's left and closes the file
+        for (uint32_t waited = 0; !g_LogStopped && waited < MONITOR_STOP_TIMEOUT_MS; waited += 10)
+            Sleep(10);
         break;
     }
 
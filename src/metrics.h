@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define METRICS_MAGIC 0x4957334D // "IW3M"
+#define METRICS_VERSION 1
+#define METRICS_DEFAULT_PORT 28970
+
+// Snapshot of the plugin's counters sent in a single datagram. Every field is a u32 sent big
+// endian in this order, tools/metrics_collector.py has the same list. Fields are only ever
+// added at the end with a version bump, fieldCount lets an older collector skip what it
+// doesn't know. Times are in ms unless the name says us, counts are totals since the counter
+// was last reset unless they're a current value
+struct MetricsPacket
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fieldCount;
+    uint32_t sequence;
+    uint32_t serverTime;
+
+    // Server frames
+    uint32_t frames;
+    uint32_t frameIntervalP50;
+    uint32_t frameIntervalP99;
+    uint32_t frameIntervalMax;
+    uint32_t frameSpikes;
+    uint32_t schedulerUs; // Last frame
+    uint32_t schedulerOverBudgetFrames;
+
+    // Phases, over the profiler's rolling window
+    uint32_t pluginFrameP50Us;
+    uint32_t pluginFrameP99Us;
+    uint32_t pluginFrameMaxUs;
+    uint32_t clientThinkP50Us;
+    uint32_t clientThinkP99Us;
+    uint32_t clientThinkMaxUs;
+    uint32_t clientCommandP50Us;
+    uint32_t clientCommandP99Us;
+    uint32_t clientCommandMaxUs;
+    uint32_t linkEntityP50Us;
+    uint32_t linkEntityP99Us;
+    uint32_t linkEntityMaxUs;
+
+    // Clients
+    uint32_t connectedClients;
+    uint32_t inGameClients;
+    uint32_t netchanDropped; // Packets the connected clients' last messages said were lost
+    uint32_t commandsDropped;
+    uint32_t commandsDuplicated;
+    uint32_t worstCommandAgeP99;
+
+    // Entities
+    uint32_t entities;
+    uint32_t pooledEntities;
+    uint32_t pooledEntitiesAllocated;
+    uint32_t nativeMovers;
+    uint32_t culledEntities;
+    uint32_t deferredLinks;
+    uint32_t flushedLinks;
+
+    // Plugin
+    uint32_t pluginArenaBytes;
+    uint32_t frameArenaPeakBytes;
+    uint32_t commandLookups;
+    uint32_t logDropped;
+    uint32_t traceEvents;
+};
+
+#define METRICS_FIELD_COUNT (sizeof(MetricsPacket) / sizeof(uint32_t))
+
+static_assert(sizeof(MetricsPacket) == METRICS_FIELD_COUNT * sizeof(uint32_t), "MetricsPacket must only hold u32 fields");
+
+// Writes the packet in wire order to pBuffer, which needs sizeof(MetricsPacket) bytes
+inline void EncodeMetricsPacket(const MetricsPacket *pPacket, uint8_t *pBuffer)
+{
+    const uint32_t *pFields = reinterpret_cast<const uint32_t *>(pPacket);
+
+    for (size_t i = 0; i < METRICS_FIELD_COUNT; i++)
+    {
+        uint32_t value = pFields[i];
+        pBuffer[i * 4 + 0] = static_cast<uint8_t>(value >> 24);
+        pBuffer[i * 4 + 1] = static_cast<uint8_t>(value >> 16);
+        pBuffer[i * 4 + 2] = static_cast<uint8_t>(value >> 8);
+        pBuffer[i * 4 + 3] = static_cast<uint8_t>(value);
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Thin wrapper over VMX128 on Xbox 360 (through XNA Math) and SSE2 on hosts, with a scalar
+// fallback, so the vectorized passes are written once
+
+#if defined(_XBOX)
+    #include <xtl.h>
+    #include <xnamath.h>
+    #define SIMD_VMX128
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define SIMD_SSE2
+#endif
+
+// Checks if the 16 bytes at pA and pB are equal, neither pointer needs to be aligned
+inline bool Simd_Equal16(const void *pA, const void *pB)
+{
+#if defined(SIMD_VMX128)
+    XMVECTOR a = XMLoadInt4(static_cast<const UINT *>(pA));
+    XMVECTOR b = XMLoadInt4(static_cast<const UINT *>(pB));
+    return XMVector4EqualInt(a, b) != FALSE;
+#elif defined(SIMD_SSE2)
+    __m128i a = _mm_loadu_si128(static_cast<const __m128i *>(pA));
+    __m128i b = _mm_loadu_si128(static_cast<const __m128i *>(pB));
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(a, b)) == 0xFFFF;
+#else
+    return memcmp(pA, pB, 16) == 0;
+#endif
+}
+
+// Four floats in a register. Loads and stores need 16 byte aligned pointers
+#if defined(SIMD_VMX128)
+typedef XMVECTOR SimdFloat4;
+#elif defined(SIMD_SSE2)
+typedef __m128 SimdFloat4;
+#else
+struct SimdFloat4
+{
+    float v[4];
+};
+#endif
+
+inline SimdFloat4 Simd_Load4(const float *pSource)
+{
+#if defined(SIMD_VMX128)
+    return XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A *>(pSource));
+#elif defined(SIMD_SSE2)
+    return _mm_load_ps(pSource);
+#else
+    SimdFloat4 result;
+    memcpy(result.v, pSource, sizeof(result.v));
+    return result;
+#endif
+}
+
+inline void Simd_Store4(float *pDestination, SimdFloat4 value)
+{
+#if defined(SIMD_VMX128)
+    XMStoreFloat4A(reinterpret_cast<XMFLOAT4A *>(pDestination), value);
+#elif defined(SIMD_SSE2)
+    _mm_store_ps(pDestination, value);
+#else
+    memcpy(pDestination, value.v, sizeof(value.v));
+#endif
+}
+
+inline SimdFloat4 Simd_Replicate(float value)
+{
+#if defined(SIMD_VMX128)
+    return XMVectorReplicate(value);
+#elif defined(SIMD_SSE2)
+    return _mm_set1_ps(value);
+#else
+    SimdFloat4 result = { { value, value, value, value } };
+    return result;
+#endif
+}
+
+inline SimdFloat4 Simd_Add(SimdFloat4 a, SimdFloat4 b)
+{
+#if defined(SIMD_VMX128)
+    return XMVectorAdd(a, b);
+#elif defined(SIMD_SSE2)
+    return _mm_add_ps(a, b);
+#else
+    SimdFloat4 result;
+    for (int i = 0; i < 4; i++)
+        result.v[i] = a.v[i] + b.v[i];
+    return result;
+#endif
+}
+
+inline SimdFloat4 Simd_Subtract(SimdFloat4 a, SimdFloat4 b)
+{
+#if defined(SIMD_VMX128)
+    return XMVectorSubtract(a, b);
+#elif defined(SIMD_SSE2)
+    return _mm_sub_ps(a, b);
+#else
+    SimdFloat4 result;
+    for (int i = 0; i < 4; i++)
+        result.v[i] = a.v[i] - b.v[i];
+    return result;
+#endif
+}
+
+inline SimdFloat4 Simd_Multiply(SimdFloat4 a, SimdFloat4 b)
+{
+#if defined(SIMD_VMX128)
+    return XMVectorMultiply(a, b);
+#elif defined(SIMD_SSE2)
+    return _mm_mul_ps(a, b);
+#else
+    SimdFloat4 result;
+    for (int i = 0; i < 4; i++)
+        result.v[i] = a.v[i] * b.v[i];
+    return result;
+#endif
+}
+
+// a * b + c, a single vmaddfp on Xenon
+inline SimdFloat4 Simd_MultiplyAdd(SimdFloat4 a, SimdFloat4 b, SimdFloat4 c)
+{
+#if defined(SIMD_VMX128)
+    return XMVectorMultiplyAdd(a, b, c);
+#elif defined(SIMD_SSE2)
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#else
+    SimdFloat4 result;
+    for (int i = 0; i < 4; i++)
+        result.v[i] = a.v[i] * b.v[i] + c.v[i];
+    return result;
+#endif
+}
+
+// Bit i of the result is set when a[i] > b[i]
+inline uint32_t Simd_GreaterMask(SimdFloat4 a, SimdFloat4 b)
+{
+#if defined(SIMD_VMX128)
+    __declspec(align(16)) UINT lanes[4];
+    XMStoreInt4A(lanes, XMVectorGreater(a, b));
+    return (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+#elif defined(SIMD_SSE2)
+    return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(a, b)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (a.v[i] > b.v[i])
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
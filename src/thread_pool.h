@@ -0,0 +1,525 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "atomics.h"
+
+#if defined(_XBOX)
+// Same import main.cpp uses to start the plugin's own threads
+extern "C" uint32_t ExCreateThread(
+    HANDLE *pHandle,
+    uint32_t stackSize,
+    uint32_t *pThreadId,
+    void *pApiThreadStartup,
+    PTHREAD_START_ROUTINE pStartAddress,
+    void *pParameter,
+    uint32_t creationFlags
+);
+#else
+    #include <pthread.h>
+#endif
+
+#define MAX_POOL_WORKERS 6
+#define WORKER_QUEUE_CAPACITY 256
+#define COMPLETION_QUEUE_CAPACITY 1024
+#define WORKER_SPIN_COUNT 64
+#define WORKER_JOIN_TIMEOUT_MS 1000
+
+typedef void (*JobFunction)(void *pContext);
+
+struct Job
+{
+    JobFunction function; // Runs on a worker thread
+    JobFunction complete; // Optional, runs on the thread that calls RunCompletions
+    void *pContext;
+};
+
+// Bounded multi-producer multi-consumer queue (Dmitry Vyukov's design). Every cell carries
+// a sequence number that tells producers and consumers whether it's theirs to use, so a
+// push or pop is a single CAS on the position in the common case.
+// Capacity must be a power of 2
+template<size_t Capacity>
+class JobQueue
+{
+public:
+    JobQueue()
+        : m_EnqueuePosition(0), m_DequeuePosition(0)
+    {
+        for (size_t i = 0; i < Capacity; i++)
+            m_Cells[i].sequence = static_cast<uint32_t>(i);
+    }
+
+    bool Push(const Job &job)
+    {
+        uint32_t position = Atomic_LoadAcquire(&m_EnqueuePosition);
+
+        for (;;)
+        {
+            Cell *pCell = &m_Cells[position & (Capacity - 1)];
+
+            // Positions wrap around, only the difference is meaningful
+            int32_t difference = static_cast<int32_t>(Atomic_LoadAcquire(&pCell->sequence) - position);
+
+            if (difference == 0)
+            {
+                uint32_t previous = Atomic_CompareExchange(&m_EnqueuePosition, position + 1, position);
+                if (previous == position)
+                {
+                    pCell->job = job;
+                    Atomic_StoreRelease(&pCell->sequence, position + 1);
+                    return true;
+                }
+
+                position = previous;
+            }
+            else if (difference < 0)
+            {
+                // The cell still holds a job from the previous lap, the queue is full
+                return false;
+            }
+            else
+            {
+                position = Atomic_LoadAcquire(&m_EnqueuePosition);
+            }
+        }
+    }
+
+    bool Pop(Job *pJob)
+    {
+        uint32_t position = Atomic_LoadAcquire(&m_DequeuePosition);
+
+        for (;;)
+        {
+            Cell *pCell = &m_Cells[position & (Capacity - 1)];
+            int32_t difference = static_cast<int32_t>(Atomic_LoadAcquire(&pCell->sequence) - (position + 1));
+
+            if (difference == 0)
+            {
+                uint32_t previous = Atomic_CompareExchange(&m_DequeuePosition, position + 1, position);
+                if (previous == position)
+                {
+                    *pJob = pCell->job;
+                    Atomic_StoreRelease(&pCell->sequence, position + static_cast<uint32_t>(Capacity));
+                    return true;
+                }
+
+                position = previous;
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = Atomic_LoadAcquire(&m_DequeuePosition);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        volatile uint32_t sequence;
+        Job job;
+    };
+
+    CACHE_ALIGN volatile uint32_t m_EnqueuePosition;
+    CACHE_ALIGN volatile uint32_t m_DequeuePosition;
+    CACHE_ALIGN Cell m_Cells[Capacity];
+};
+
+// Auto-reset event, Set wakes the thread waiting on it or makes its next Wait return right away
+class WorkerEvent
+{
+public:
+    bool Create()
+    {
+#if defined(_XBOX)
+        m_Handle = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        return m_Handle != nullptr;
+#else
+        m_Signaled = false;
+        return pthread_mutex_init(&m_Mutex, nullptr) == 0 && pthread_cond_init(&m_Condition, nullptr) == 0;
+#endif
+    }
+
+    void Destroy()
+    {
+#if defined(_XBOX)
+        CloseHandle(m_Handle);
+        m_Handle = nullptr;
+#else
+        pthread_cond_destroy(&m_Condition);
+        pthread_mutex_destroy(&m_Mutex);
+#endif
+    }
+
+    void Set()
+    {
+#if defined(_XBOX)
+        SetEvent(m_Handle);
+#else
+        pthread_mutex_lock(&m_Mutex);
+        m_Signaled = true;
+        pthread_cond_signal(&m_Condition);
+        pthread_mutex_unlock(&m_Mutex);
+#endif
+    }
+
+    void Wait()
+    {
+#if defined(_XBOX)
+        WaitForSingleObject(m_Handle, INFINITE);
+#else
+        pthread_mutex_lock(&m_Mutex);
+        while (!m_Signaled)
+            pthread_cond_wait(&m_Condition, &m_Mutex);
+        m_Signaled = false;
+        pthread_mutex_unlock(&m_Mutex);
+#endif
+    }
+
+private:
+#if defined(_XBOX)
+    HANDLE m_Handle;
+#else
+    pthread_mutex_t m_Mutex;
+    pthread_cond_t m_Condition;
+    bool m_Signaled;
+#endif
+};
+
+// Small pool of worker threads pinned to hardware threads the game leaves idle. Every worker
+// owns a queue, submissions are spread across them and a worker that runs out of jobs steals
+// from the others. Jobs with a complete callback are handed back through the completion queue
+// so results that touch engine state are applied on the server thread. Idle workers sleep on
+// an event until a submission wakes them
+class ThreadPool
+{
+public:
+    ThreadPool()
+        : m_WorkerCount(0), m_Stopping(0), m_NextQueue(0), m_Submitted(0), m_Executed(0), m_Stolen(0), m_Rejected(0), m_CompletionsDropped(0), m_Wakeups(0)
+    {
+    }
+
+    ~ThreadPool()
+    {
+        Stop();
+    }
+
+    bool Start(const uint32_t *pHardwareThreads, size_t workerCount)
+    {
+        if (m_WorkerCount != 0 || workerCount == 0 || workerCount > MAX_POOL_WORKERS)
+            return false;
+
+        Atomic_StoreRelease(&m_Stopping, 0);
+
+        // Workers steal from each other so the count has to be set before any of them starts
+        m_WorkerCount = workerCount;
+
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            Worker *pWorker = &m_Workers[i];
+            pWorker->pPool = this;
+            pWorker->index = i;
+            pWorker->hardwareThread = pHardwareThreads[i];
+            pWorker->sleeping = 0;
+
+            if (!pWorker->wakeUp.Create())
+            {
+                StopWorkers(i);
+                return false;
+            }
+
+            if (!StartWorkerThread(pWorker))
+            {
+                pWorker->wakeUp.Destroy();
+                StopWorkers(i);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Waits for the workers to finish the job they're running. Jobs still queued and
+    // completions that didn't run are dropped, their owners have to forget about them.
+    // Must not be called from DllMain, waiting for threads under the loader lock can deadlock
+    void Stop()
+    {
+        StopWorkers(m_WorkerCount);
+    }
+
+    bool IsRunning() const { return m_WorkerCount != 0; }
+
+    // Can be called from any thread, returns false if the pool isn't running or every queue
+    // is full so the caller can fall back to doing the work inline
+    bool Submit(JobFunction function, void *pContext, JobFunction complete = nullptr)
+    {
+        // Read once, Stop may clear it from another thread
+        size_t workerCount = m_WorkerCount;
+        if (workerCount == 0)
+            return false;
+
+        Job job;
+        job.function = function;
+        job.complete = complete;
+        job.pContext = pContext;
+
+        uint32_t start = static_cast<uint32_t>(Atomic_Increment(&m_NextQueue));
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            size_t queue = (start + i) % workerCount;
+            if (m_Workers[queue].queue.Push(job))
+            {
+                Atomic_Increment(&m_Submitted);
+                WakeWorker(queue, workerCount);
+                return true;
+            }
+        }
+
+        Atomic_Increment(&m_Rejected);
+        return false;
+    }
+
+    // Runs up to maxCount completion callbacks on the calling thread, returns how many ran
+    size_t RunCompletions(size_t maxCount)
+    {
+        size_t count = 0;
+        Job job;
+
+        while (count < maxCount && m_Completions.Pop(&job))
+        {
+            job.complete(job.pContext);
+            count++;
+        }
+
+        return count;
+    }
+
+    int32_t GetSubmittedCount() const { return Atomic_LoadAcquire(&m_Submitted); }
+
+    int32_t GetExecutedCount() const { return Atomic_LoadAcquire(&m_Executed); }
+
+    int32_t GetStolenCount() const { return Atomic_LoadAcquire(&m_Stolen); }
+
+    int32_t GetRejectedCount() const { return Atomic_LoadAcquire(&m_Rejected); }
+
+    int32_t GetCompletionsDroppedCount() const { return Atomic_LoadAcquire(&m_CompletionsDropped); }
+
+    int32_t GetWakeupCount() const { return Atomic_LoadAcquire(&m_Wakeups); }
+
+private:
+    struct Worker
+    {
+        JobQueue<WORKER_QUEUE_CAPACITY> queue;
+        ThreadPool *pPool;
+        size_t index;
+        uint32_t hardwareThread;
+        WorkerEvent wakeUp;
+        CACHE_ALIGN volatile int32_t sleeping; // 1 while waiting on wakeUp, or about to
+#if defined(_XBOX)
+        volatile int32_t running;
+        HANDLE thread;
+#else
+        pthread_t thread;
+#endif
+    };
+
+    Worker m_Workers[MAX_POOL_WORKERS];
+    JobQueue<COMPLETION_QUEUE_CAPACITY> m_Completions;
+    size_t m_WorkerCount;
+    CACHE_ALIGN volatile int32_t m_Stopping;
+    CACHE_ALIGN volatile int32_t m_NextQueue;
+    CACHE_ALIGN volatile int32_t m_Submitted;
+    volatile int32_t m_Executed;
+    volatile int32_t m_Stolen;
+    volatile int32_t m_Rejected;
+    volatile int32_t m_CompletionsDropped;
+    volatile int32_t m_Wakeups;
+
+    void StopWorkers(size_t startedCount)
+    {
+        if (m_WorkerCount == 0)
+            return;
+
+        Atomic_StoreRelease(&m_Stopping, 1);
+        Atomic_FullBarrier();
+
+        for (size_t i = 0; i < startedCount; i++)
+            m_Workers[i].wakeUp.Set();
+
+        for (size_t i = 0; i < startedCount; i++)
+        {
+            JoinWorkerThread(&m_Workers[i]);
+            m_Workers[i].wakeUp.Destroy();
+        }
+
+        Job job;
+        for (size_t i = 0; i < startedCount; i++)
+        {
+            while (m_Workers[i].queue.Pop(&job))
+                ;
+        }
+
+        while (m_Completions.Pop(&job))
+            ;
+
+        m_WorkerCount = 0;
+    }
+
+    // Wakes a sleeping worker, the one that owns the queue the job went to if it sleeps. The
+    // full barrier pairs with the one in RunWorker: either the worker sees the job when it
+    // checks the queues again, or this sees the worker's sleeping flag
+    void WakeWorker(size_t preferred, size_t workerCount)
+    {
+        Atomic_FullBarrier();
+
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            Worker *pWorker = &m_Workers[(preferred + i) % workerCount];
+            if (Atomic_LoadAcquire(&pWorker->sleeping) != 0 && Atomic_CompareExchange(&pWorker->sleeping, 0, 1) == 1)
+            {
+                Atomic_Increment(&m_Wakeups);
+                pWorker->wakeUp.Set();
+                return;
+            }
+        }
+    }
+
+    bool TakeJob(Worker *pWorker, Job *pJob)
+    {
+        if (pWorker->queue.Pop(pJob))
+            return true;
+
+        for (size_t i = 1; i < m_WorkerCount; i++)
+        {
+            if (m_Workers[(pWorker->index + i) % m_WorkerCount].queue.Pop(pJob))
+            {
+                Atomic_Increment(&m_Stolen);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void RunJob(Job *pJob)
+    {
+        pJob->function(pJob->pContext);
+        Atomic_Increment(&m_Executed);
+
+        if (pJob->complete != nullptr && !m_Completions.Push(*pJob))
+            Atomic_Increment(&m_CompletionsDropped);
+    }
+
+    void RunWorker(Worker *pWorker)
+    {
+        uint32_t idleCount = 0;
+        Job job;
+
+        while (Atomic_LoadAcquire(&m_Stopping) == 0)
+        {
+            if (TakeJob(pWorker, &job))
+            {
+                idleCount = 0;
+                RunJob(&job);
+                continue;
+            }
+
+            // Spin briefly since jobs tend to come in bursts
+            if (++idleCount < WORKER_SPIN_COUNT)
+            {
+                Thread_Yield();
+                continue;
+            }
+
+            // Then sleep until a submission or Stop sets the event. The queues are checked
+            // once more after raising the flag so a job pushed in between isn't missed
+            Atomic_StoreRelease(&pWorker->sleeping, 1);
+            Atomic_FullBarrier();
+
+            bool taken = TakeJob(pWorker, &job);
+            if (!taken && Atomic_LoadAcquire(&m_Stopping) == 0)
+                pWorker->wakeUp.Wait();
+
+            // Clears the flag if nobody else did. If a submitter cleared it after the job was
+            // taken anyway, its event is left set and the next wait returns right away
+            Atomic_CompareExchange(&pWorker->sleeping, 0, 1);
+            idleCount = 0;
+
+            if (taken)
+                RunJob(&job);
+        }
+    }
+
+#if defined(_XBOX)
+    static DWORD WINAPI WorkerMain(void *pParameter)
+    {
+        Worker *pWorker = static_cast<Worker *>(pParameter);
+        pWorker->pPool->RunWorker(pWorker);
+        Atomic_StoreRelease(&pWorker->running, 0);
+        return 0;
+    }
+
+    // Created suspended with the same flag as the plugin's other threads, so it can be pinned
+    // before it runs
+    bool StartWorkerThread(Worker *pWorker)
+    {
+        pWorker->running = 1;
+        pWorker->thread = nullptr;
+        ExCreateThread(&pWorker->thread, 0, nullptr, nullptr, reinterpret_cast<PTHREAD_START_ROUTINE>(WorkerMain), pWorker, 2 | CREATE_SUSPENDED);
+        if (pWorker->thread == nullptr)
+            return false;
+
+        XSetThreadProcessor(pWorker->thread, pWorker->hardwareThread);
+        ResumeThread(pWorker->thread);
+        return true;
+    }
+
+    // Waits for the worker to leave RunWorker rather than for the thread to end, since
+    // the thread only ends once the loader lock is free when the plugin is being unloaded.
+    // A worker stuck in a job is given up on after WORKER_JOIN_TIMEOUT_MS so unloading
+    // can't hang on it
+    void JoinWorkerThread(Worker *pWorker)
+    {
+        for (uint32_t waited = 0; Atomic_LoadAcquire(&pWorker->running) != 0 && waited < WORKER_JOIN_TIMEOUT_MS; waited++)
+            Thread_Sleep(1);
+
+        CloseHandle(pWorker->thread);
+        pWorker->thread = nullptr;
+    }
+#else
+    static void *WorkerMain(void *pParameter)
+    {
+        Worker *pWorker = static_cast<Worker *>(pParameter);
+        pWorker->pPool->RunWorker(pWorker);
+        return nullptr;
+    }
+
+    bool StartWorkerThread(Worker *pWorker)
+    {
+        if (pthread_create(&pWorker->thread, nullptr, WorkerMain, pWorker) != 0)
+            return false;
+
+    #if defined(__linux__)
+        long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+        if (processorCount > 0)
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(pWorker->hardwareThread % processorCount, &cpuSet);
+            pthread_setaffinity_np(pWorker->thread, sizeof(cpuSet), &cpuSet);
+        }
+    #endif
+
+        return true;
+    }
+
+    void JoinWorkerThread(Worker *pWorker)
+    {
+        pthread_join(pWorker->thread, nullptr);
+    }
+#endif
+};
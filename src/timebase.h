@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_XBOX)
+    #include <xtl.h>
+#else
+    #include <time.h>
+#endif
+
+// Reading the time base register with __mftb is a single instruction, cheap enough to
+// timestamp hot paths. Host builds use the monotonic clock in nanoseconds instead
+inline uint64_t ReadTimeBase()
+{
+#if defined(_XBOX)
+    return __mftb();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+// Ticks per second of ReadTimeBase
+inline uint64_t GetTimeBaseFrequency()
+{
+#if defined(_XBOX)
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+#else
+    return 1000000000ull;
+#endif
+}
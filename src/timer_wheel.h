@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_MAX_DELAY ((1u << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+#define TIMER_INDEX_BITS 20
+#define TIMER_INDEX_MASK ((1u << TIMER_INDEX_BITS) - 1)
+#define TIMER_INVALID_HANDLE 0
+
+typedef void (*TimerCallback)(void *pContext, uint32_t handle);
+
+// Hierarchical timer wheel with Capacity timers, time is counted in ticks and advanced one
+// tick at a time. Level 0 has a slot per tick for the next 64 ticks, each higher level has
+// slots 64 times as wide. A timer goes in the level its delay fits in and moves down a level
+// every time the wheel below completes a turn, so scheduling and cancelling are O(1) and a
+// tick only touches the timers that expire or move down. Delays are capped at
+// TIMER_WHEEL_MAX_DELAY ticks, 9 days at 20 ticks per second.
+// Handles carry a generation so a handle to a timer that already fired or was cancelled is
+// rejected instead of cancelling whatever timer reuses the slot. Capacity must be less than
+// 2^TIMER_INDEX_BITS
+template<size_t Capacity>
+class TimerWheel
+{
+public:
+    TimerWheel()
+    {
+        Reset();
+    }
+
+    // Drops every pending timer without calling it
+    void Reset()
+    {
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                m_Slots[level][slot] = -1;
+        }
+
+        for (size_t i = 0; i < Capacity; i++)
+        {
+            m_Timers[i].next = i + 1 < Capacity ? static_cast<int32_t>(i + 1) : -1;
+            m_Timers[i].generation = 1;
+            m_Timers[i].pending = false;
+        }
+
+        m_FreeList = Capacity != 0 ? 0 : -1;
+        m_Now = 0;
+        m_PendingCount = 0;
+        m_Failures = 0;
+    }
+
+    // Returns TIMER_INVALID_HANDLE when every timer is in use. A delay of 0 fires on the next tick
+    uint32_t Schedule(uint32_t delay, TimerCallback callback, void *pContext)
+    {
+        if (m_FreeList == -1)
+        {
+            m_Failures++;
+            return TIMER_INVALID_HANDLE;
+        }
+
+        int32_t index = m_FreeList;
+        Timer *pTimer = &m_Timers[index];
+        m_FreeList = pTimer->next;
+
+        if (delay == 0)
+            delay = 1;
+        if (delay > TIMER_WHEEL_MAX_DELAY)
+            delay = TIMER_WHEEL_MAX_DELAY;
+
+        pTimer->expiry = m_Now + delay;
+        pTimer->callback = callback;
+        pTimer->pContext = pContext;
+        pTimer->pending = true;
+        m_PendingCount++;
+
+        Insert(index);
+        return MakeHandle(index);
+    }
+
+    // Returns false if the timer already fired or was cancelled
+    bool Cancel(uint32_t handle)
+    {
+        int32_t index = GetPendingIndex(handle);
+        if (index == -1)
+            return false;
+
+        Unlink(index);
+        Release(index);
+        return true;
+    }
+
+    bool IsPending(uint32_t handle) const
+    {
+        return GetPendingIndex(handle) != -1;
+    }
+
+    // Ticks left before the timer fires, 0 if it isn't pending
+    uint32_t GetRemaining(uint32_t handle) const
+    {
+        int32_t index = GetPendingIndex(handle);
+        return index != -1 ? m_Timers[index].expiry - m_Now : 0;
+    }
+
+    // Slot of the timer in 0..Capacity-1, for callers that keep data next to each timer
+    static size_t GetIndex(uint32_t handle)
+    {
+        return handle & TIMER_INDEX_MASK;
+    }
+
+    // Moves time forward a tick and calls every timer that expires, returns how many fired.
+    // Callbacks can schedule and cancel timers, including their own handle which is already stale
+    size_t Advance()
+    {
+        m_Now++;
+
+        // Every time a level completes a turn, the next slot of the level above moves down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if ((m_Now & ((1u << (level * TIMER_WHEEL_SLOT_BITS)) - 1)) != 0)
+                break;
+
+            Cascade(level, (m_Now >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1));
+        }
+
+        size_t fired = 0;
+        int32_t *pHead = &m_Slots[0][m_Now & (TIMER_WHEEL_SLOTS - 1)];
+
+        while (*pHead != -1)
+        {
+            int32_t index = *pHead;
+            Timer *pTimer = &m_Timers[index];
+            TimerCallback callback = pTimer->callback;
+            void *pContext = pTimer->pContext;
+            uint32_t handle = MakeHandle(index);
+
+            Unlink(index);
+            Release(index);
+
+            callback(pContext, handle);
+            fired++;
+        }
+
+        return fired;
+    }
+
+    uint32_t GetNow() const { return m_Now; }
+
+    size_t GetPendingCount() const { return m_PendingCount; }
+
+    size_t GetCapacity() const { return Capacity; }
+
+    uint32_t GetFailureCount() const { return m_Failures; }
+
+private:
+    struct Timer
+    {
+        int32_t next;
+        int32_t prev;
+        uint32_t expiry;
+        uint16_t generation;
+        uint8_t level;
+        bool pending;
+        uint8_t slot;
+        TimerCallback callback;
+        void *pContext;
+    };
+
+    Timer m_Timers[Capacity];
+    int32_t m_Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    int32_t m_FreeList;
+    uint32_t m_Now;
+    size_t m_PendingCount;
+    uint32_t m_Failures;
+
+    uint32_t MakeHandle(int32_t index) const
+    {
+        return (static_cast<uint32_t>(m_Timers[index].generation) << TIMER_INDEX_BITS) | static_cast<uint32_t>(index);
+    }
+
+    int32_t GetPendingIndex(uint32_t handle) const
+    {
+        size_t index = handle & TIMER_INDEX_MASK;
+        if (handle == TIMER_INVALID_HANDLE || index >= Capacity)
+            return -1;
+
+        const Timer *pTimer = &m_Timers[index];
+        if (!pTimer->pending || pTimer->generation != (handle >> TIMER_INDEX_BITS))
+            return -1;
+
+        return static_cast<int32_t>(index);
+    }
+
+    void Insert(int32_t index)
+    {
+        Timer *pTimer = &m_Timers[index];
+        uint32_t delay = pTimer->expiry - m_Now;
+
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delay >= (1u << ((level + 1) * TIMER_WHEEL_SLOT_BITS)))
+            level++;
+
+        uint32_t slot = (pTimer->expiry >> (level * TIMER_WHEEL_SLOT_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+        int32_t *pHead = &m_Slots[level][slot];
+
+        pTimer->level = static_cast<uint8_t>(level);
+        pTimer->slot = static_cast<uint8_t>(slot);
+        pTimer->prev = -1;
+        pTimer->next = *pHead;
+        if (*pHead != -1)
+            m_Timers[*pHead].prev = index;
+        *pHead = index;
+    }
+
+    void Unlink(int32_t index)
+    {
+        Timer *pTimer = &m_Timers[index];
+
+        if (pTimer->prev != -1)
+            m_Timers[pTimer->prev].next = pTimer->next;
+        else
+            m_Slots[pTimer->level][pTimer->slot] = pTimer->next;
+
+        if (pTimer->next != -1)
+            m_Timers[pTimer->next].prev = pTimer->prev;
+    }
+
+    void Release(int32_t index)
+    {
+        Timer *pTimer = &m_Timers[index];
+        pTimer->pending = false;
+
+        // Generation 0 is skipped so no handle is ever TIMER_INVALID_HANDLE
+        pTimer->generation = static_cast<uint16_t>((pTimer->generation + 1) & ((1u << (32 - TIMER_INDEX_BITS)) - 1));
+        if (pTimer->generation == 0)
+            pTimer->generation = 1;
+
+        pTimer->next = m_FreeList;
+        m_FreeList = index;
+        m_PendingCount--;
+    }
+
+    void Cascade(int level, uint32_t slot)
+    {
+        int32_t index = m_Slots[level][slot];
+        m_Slots[level][slot] = -1;
+
+        while (index != -1)
+        {
+            int32_t next = m_Timers[index].next;
+            Insert(index);
+            index = next;
+        }
+    }
+};
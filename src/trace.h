@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "atomics.h"
+#include "timebase.h"
+
+#define MAX_TRACE_THREADS 8
+#define TRACE_RING_CAPACITY 1024 // Must be a power of 2
+#define MAX_TRACE_NAMES 256
+#define TRACE_DUMP_GUARD_EVENTS 4
+
+#define TRACE_FILE_MAGIC 0x49573354 // "IW3T"
+#define TRACE_FILE_VERSION 1
+#define TRACE_UNKNOWN_NAME 0xFFFF
+
+enum TraceEventType
+{
+    TRACE_EVENT_BEGIN,
+    TRACE_EVENT_END,
+    TRACE_EVENT_INSTANT,
+};
+
+struct TraceEvent
+{
+    uint64_t time;
+    const char *name; // Must outlive the capture, like a literal
+    uint32_t arg;
+    uint32_t type;
+};
+
+// Only written by the thread that owns it. It's a flight recorder, once it's full the oldest
+// events are overwritten so a dump always has the last TRACE_RING_CAPACITY events
+struct TraceRing
+{
+    CACHE_ALIGN volatile int32_t head;
+    volatile int32_t threadId;
+    TraceEvent events[TRACE_RING_CAPACITY];
+};
+
+// Dump file layout, every value is big endian:
+//   u32 magic, u32 version, u64 time base ticks per second, u32 name count, u32 thread count
+//   per name: u16 length, the characters without a terminator
+//   per thread: u32 thread id, u32 event count, then per event u64 time, u16 name index,
+//   u8 type, u8 reserved, u32 arg
+class Tracer
+{
+public:
+    Tracer()
+        : m_Enabled(0), m_RingCount(0), m_UnregisteredDrops(0)
+    {
+        memset(m_Rings, 0, sizeof(m_Rings));
+    }
+
+    bool IsEnabled() const { return Atomic_LoadAcquire(&m_Enabled) != 0; }
+
+    void SetEnabled(bool enabled)
+    {
+        Atomic_StoreRelease(&m_Enabled, enabled ? 1 : 0);
+    }
+
+    // Called from hot paths, costs a flag check when tracing is off
+    void Write(TraceEventType type, const char *name, uint32_t arg)
+    {
+        if (!IsEnabled())
+            return;
+
+        TraceRing *pRing = GetThreadRing();
+        if (pRing == nullptr)
+        {
+            Atomic_Increment(&m_UnregisteredDrops);
+            return;
+        }
+
+        int32_t head = pRing->head;
+        TraceEvent *pEvent = &pRing->events[head & (TRACE_RING_CAPACITY - 1)];
+        pEvent->time = ReadTimeBase();
+        pEvent->name = name;
+        pEvent->arg = arg;
+        pEvent->type = type;
+
+        Atomic_StoreRelease(&pRing->head, head + 1);
+    }
+
+    // Forgets every event, only call while tracing is off
+    void Clear()
+    {
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+        for (int32_t i = 0; i < ringCount; i++)
+            Atomic_StoreRelease(&m_Rings[i].head, 0);
+    }
+
+    uint32_t GetEventCount() const
+    {
+        uint32_t count = 0;
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+        {
+            int32_t head = Atomic_LoadAcquire(&m_Rings[i].head);
+            count += head < TRACE_RING_CAPACITY ? head : TRACE_RING_CAPACITY;
+        }
+
+        return count;
+    }
+
+    int32_t GetThreadCount() const { return Atomic_LoadAcquire(&m_RingCount); }
+
+    uint32_t GetDroppedCount() const { return Atomic_LoadAcquire(&m_UnregisteredDrops); }
+
+    // Writes every ring to the file and returns the number of events written, or -1 if a write
+    // failed. Only call while tracing is off, a thread that was already past the enabled check
+    // may still overwrite the oldest events of a full ring so those few are left out
+    int32_t Dump(FILE *pFile) const
+    {
+        const char *names[MAX_TRACE_NAMES];
+        size_t nameCount = 0;
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+        {
+            int32_t first, head;
+            GetDumpRange(&m_Rings[i], &first, &head);
+
+            for (int32_t j = first; j != head; j++)
+                FindOrAddName(names, &nameCount, m_Rings[i].events[j & (TRACE_RING_CAPACITY - 1)].name);
+        }
+
+        bool ok = WriteU32(pFile, TRACE_FILE_MAGIC) && WriteU32(pFile, TRACE_FILE_VERSION) && WriteU64(pFile, GetTimeBaseFrequency());
+        ok = ok && WriteU32(pFile, static_cast<uint32_t>(nameCount)) && WriteU32(pFile, static_cast<uint32_t>(ringCount));
+
+        for (size_t i = 0; i < nameCount && ok; i++)
+        {
+            size_t length = strlen(names[i]);
+            if (length > 0xFFFF)
+                length = 0xFFFF;
+
+            ok = WriteU16(pFile, static_cast<uint16_t>(length)) && fwrite(names[i], 1, length, pFile) == length;
+        }
+
+        int32_t eventCount = 0;
+        for (int32_t i = 0; i < ringCount && ok; i++)
+        {
+            const TraceRing *pRing = &m_Rings[i];
+            int32_t first, head;
+            GetDumpRange(pRing, &first, &head);
+
+            ok = WriteU32(pFile, static_cast<uint32_t>(pRing->threadId)) && WriteU32(pFile, static_cast<uint32_t>(head - first));
+
+            for (int32_t j = first; j != head && ok; j++)
+            {
+                const TraceEvent *pEvent = &pRing->events[j & (TRACE_RING_CAPACITY - 1)];
+                uint8_t typeAndReserved[2] = { static_cast<uint8_t>(pEvent->type), 0 };
+
+                ok = WriteU64(pFile, pEvent->time) && WriteU16(pFile, FindName(names, nameCount, pEvent->name));
+                ok = ok && fwrite(typeAndReserved, 1, sizeof(typeAndReserved), pFile) == sizeof(typeAndReserved) && WriteU32(pFile, pEvent->arg);
+            }
+
+            eventCount += head - first;
+        }
+
+        return ok ? eventCount : -1;
+    }
+
+private:
+    TraceRing m_Rings[MAX_TRACE_THREADS];
+    volatile int32_t m_Enabled;
+    volatile int32_t m_RingCount;
+    volatile int32_t m_UnregisteredDrops;
+
+    // Same as the logger, every thread that traces gets a ring the first time it writes
+    TraceRing *GetThreadRing()
+    {
+        int32_t threadId = static_cast<int32_t>(Thread_GetCurrentId());
+        int32_t ringCount = Atomic_LoadAcquire(&m_RingCount);
+
+        for (int32_t i = 0; i < ringCount; i++)
+        {
+            if (Atomic_LoadAcquire(&m_Rings[i].threadId) == threadId)
+                return &m_Rings[i];
+        }
+
+        for (;;)
+        {
+            if (ringCount >= MAX_TRACE_THREADS)
+                return nullptr;
+
+            int32_t previous = Atomic_CompareExchange(&m_RingCount, ringCount + 1, ringCount);
+            if (previous == ringCount)
+            {
+                Atomic_StoreRelease(&m_Rings[ringCount].threadId, threadId);
+                return &m_Rings[ringCount];
+            }
+
+            ringCount = previous;
+        }
+    }
+
+    static void GetDumpRange(const TraceRing *pRing, int32_t *pFirst, int32_t *pHead)
+    {
+        int32_t head = Atomic_LoadAcquire(&pRing->head);
+        *pHead = head;
+        *pFirst = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY + TRACE_DUMP_GUARD_EVENTS : 0;
+    }
+
+    static uint16_t FindName(const char *const *names, size_t nameCount, const char *name)
+    {
+        for (size_t i = 0; i < nameCount; i++)
+        {
+            if (names[i] == name)
+                return static_cast<uint16_t>(i);
+        }
+
+        return TRACE_UNKNOWN_NAME;
+    }
+
+    static void FindOrAddName(const char **names, size_t *pNameCount, const char *name)
+    {
+        if (name == nullptr || FindName(names, *pNameCount, name) != TRACE_UNKNOWN_NAME || *pNameCount == MAX_TRACE_NAMES)
+            return;
+
+        names[(*pNameCount)++] = name;
+    }
+
+    static bool WriteU16(FILE *pFile, uint16_t value)
+    {
+        uint8_t bytes[2] = { static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+        return fwrite(bytes, 1, sizeof(bytes), pFile) == sizeof(bytes);
+    }
+
+    static bool WriteU32(FILE *pFile, uint32_t value)
+    {
+        return WriteU16(pFile, static_cast<uint16_t>(value >> 16)) && WriteU16(pFile, static_cast<uint16_t>(value));
+    }
+
+    static bool WriteU64(FILE *pFile, uint64_t value)
+    {
+        return WriteU32(pFile, static_cast<uint32_t>(value >> 32)) && WriteU32(pFile, static_cast<uint32_t>(value));
+    }
+};
+
+extern Tracer g_Tracer;
+
+// Begins a span when constructed and ends it when the scope exits
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name, uint32_t arg = 0)
+        : m_Name(name)
+    {
+        g_Tracer.Write(TRACE_EVENT_BEGIN, name, arg);
+    }
+
+    ~TraceSpan()
+    {
+        g_Tracer.Write(TRACE_EVENT_END, m_Name, 0);
+    }
+
+private:
+    const char *m_Name;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_SPAN_ARG(name, arg) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name, static_cast<uint32_t>(arg))
+#define TRACE_INSTANT(name, arg) g_Tracer.Write(TRACE_EVENT_INSTANT, name, static_cast<uint32_t>(arg))
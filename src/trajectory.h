@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "atomics.h"
+#include "simd.h"
+
+#define DEFAULT_GRAVITY 800.0f
+#define TRAJECTORY_PI 3.14159265358979f
+
+// Same values as the engine's trType_t
+enum TrajectoryType
+{
+    TRAJECTORY_STATIONARY = 0,
+    TRAJECTORY_INTERPOLATE = 1,
+    TRAJECTORY_LINEAR = 2,
+    TRAJECTORY_LINEAR_STOP = 3,
+    TRAJECTORY_SINE = 4,
+    TRAJECTORY_GRAVITY = 5,
+    TRAJECTORY_ACCELERATE = 6,
+    TRAJECTORY_DECELERATE = 7,
+};
+
+// Every supported type comes down to position = base + delta * positionScale and
+// velocity = delta * velocityScale, gravity also pulls the z component down
+struct TrajectoryScales
+{
+    float position;
+    float velocity;
+    float gravityTime; // Seconds of free fall, 0 for anything but gravity
+};
+
+inline TrajectoryScales GetTrajectoryScales(int type, int time, int duration, int atTime)
+{
+    TrajectoryScales scales = { 0.0f, 0.0f, 0.0f };
+    float deltaTime = (atTime - time) * 0.001f;
+    float durationTime = duration * 0.001f;
+
+    switch (type)
+    {
+    case TRAJECTORY_LINEAR:
+        scales.position = deltaTime;
+        scales.velocity = 1.0f;
+        break;
+    case TRAJECTORY_LINEAR_STOP:
+        if (deltaTime >= 0.0f && deltaTime < durationTime)
+            scales.velocity = 1.0f;
+        if (deltaTime > durationTime)
+            deltaTime = durationTime;
+        scales.position = deltaTime > 0.0f ? deltaTime : 0.0f;
+        break;
+    case TRAJECTORY_SINE:
+    {
+        // A sine without a period doesn't move, the phase would be a division by zero
+        if (duration <= 0)
+            break;
+
+        float phase = static_cast<float>(atTime - time) / duration * TRAJECTORY_PI * 2.0f;
+        scales.position = sinf(phase);
+        scales.velocity = cosf(phase) * TRAJECTORY_PI * 2.0f / durationTime;
+        break;
+    }
+    case TRAJECTORY_GRAVITY:
+        scales.position = deltaTime;
+        scales.velocity = 1.0f;
+        scales.gravityTime = deltaTime;
+        break;
+    case TRAJECTORY_ACCELERATE:
+    case TRAJECTORY_DECELERATE:
+    {
+        bool moving = deltaTime < durationTime;
+        if (deltaTime > durationTime)
+            deltaTime = durationTime;
+        if (deltaTime < 0.0f)
+            deltaTime = 0.0f;
+
+        // trDelta is the final speed when accelerating and the initial speed when decelerating
+        float ramp = durationTime > 0.0f ? deltaTime / durationTime : 1.0f;
+        scales.position = 0.5f * deltaTime * ramp;
+        scales.velocity = moving ? ramp : 0.0f;
+
+        if (type == TRAJECTORY_DECELERATE)
+        {
+            scales.position = deltaTime - scales.position;
+            scales.velocity = moving ? 1.0f - ramp : 0.0f;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    return scales;
+}
+
+// Scalar reference, also used for one off evaluations. pPosition and pVelocity can be null
+inline void EvaluateTrajectory(int type, int time, int duration, const float *pBase, const float *pDelta, int atTime, float *pPosition, float *pVelocity)
+{
+    TrajectoryScales scales = GetTrajectoryScales(type, time, duration, atTime);
+
+    if (pPosition)
+    {
+        for (int i = 0; i < 3; i++)
+            pPosition[i] = pBase[i] + pDelta[i] * scales.position;
+
+        pPosition[2] -= 0.5f * DEFAULT_GRAVITY * scales.gravityTime * scales.gravityTime;
+    }
+
+    if (pVelocity)
+    {
+        for (int i = 0; i < 3; i++)
+            pVelocity[i] = pDelta[i] * scales.velocity;
+
+        pVelocity[2] -= DEFAULT_GRAVITY * scales.gravityTime;
+    }
+}
+
+// Trajectories stored as structure of arrays so a batch is evaluated 4 at a time. The per
+// trajectory scales depend on the type and are computed first, the positions and velocities
+// are then a multiply-add per component over whole vectors. Capacity must be a multiple of 4
+template<size_t Capacity>
+class TrajectoryBatch
+{
+public:
+    TrajectoryBatch()
+        : m_Count(0)
+    {
+    }
+
+    void Clear()
+    {
+        m_Count = 0;
+    }
+
+    size_t GetCount() const { return m_Count; }
+
+    bool IsFull() const { return m_Count == Capacity; }
+
+    // Returns the index of the trajectory in the batch or -1 if the batch is full
+    int Add(int type, int time, int duration, const float *pBase, const float *pDelta)
+    {
+        if (m_Count == Capacity)
+            return -1;
+
+        size_t index = m_Count++;
+        m_Types[index] = type;
+        m_Times[index] = time;
+        m_Durations[index] = duration;
+
+        for (int i = 0; i < 3; i++)
+        {
+            m_Base[i][index] = pBase[i];
+            m_Delta[i][index] = pDelta[i];
+        }
+
+        return static_cast<int>(index);
+    }
+
+    void Evaluate(int atTime)
+    {
+        size_t paddedCount = PadToVector();
+        ComputeScales(atTime, paddedCount);
+
+        SimdFloat4 halfGravity = Simd_Replicate(0.5f * DEFAULT_GRAVITY);
+        SimdFloat4 gravity = Simd_Replicate(DEFAULT_GRAVITY);
+
+        for (size_t i = 0; i < paddedCount; i += 4)
+        {
+            SimdFloat4 positionScale = Simd_Load4(&m_PositionScales[i]);
+            SimdFloat4 velocityScale = Simd_Load4(&m_VelocityScales[i]);
+            SimdFloat4 gravityTime = Simd_Load4(&m_GravityTimes[i]);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                SimdFloat4 base = Simd_Load4(&m_Base[axis][i]);
+                SimdFloat4 delta = Simd_Load4(&m_Delta[axis][i]);
+                SimdFloat4 position = Simd_MultiplyAdd(delta, positionScale, base);
+                SimdFloat4 velocity = Simd_Multiply(delta, velocityScale);
+
+                if (axis == 2)
+                {
+                    position = Simd_Subtract(position, Simd_Multiply(Simd_Multiply(halfGravity, gravityTime), gravityTime));
+                    velocity = Simd_Subtract(velocity, Simd_Multiply(gravity, gravityTime));
+                }
+
+                Simd_Store4(&m_Positions[axis][i], position);
+                Simd_Store4(&m_Velocities[axis][i], velocity);
+            }
+        }
+    }
+
+    // Same results as Evaluate through the scalar reference, one trajectory at a time
+    void EvaluateScalar(int atTime)
+    {
+        for (size_t i = 0; i < m_Count; i++)
+        {
+            float base[3] = { m_Base[0][i], m_Base[1][i], m_Base[2][i] };
+            float delta[3] = { m_Delta[0][i], m_Delta[1][i], m_Delta[2][i] };
+            float position[3];
+            float velocity[3];
+
+            EvaluateTrajectory(m_Types[i], m_Times[i], m_Durations[i], base, delta, atTime, position, velocity);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                m_Positions[axis][i] = position[axis];
+                m_Velocities[axis][i] = velocity[axis];
+            }
+        }
+    }
+
+    void GetPosition(size_t index, float *pPosition) const
+    {
+        for (int axis = 0; axis < 3; axis++)
+            pPosition[axis] = m_Positions[axis][index];
+    }
+
+    void GetVelocity(size_t index, float *pVelocity) const
+    {
+        for (int axis = 0; axis < 3; axis++)
+            pVelocity[axis] = m_Velocities[axis][index];
+    }
+
+    // Component arrays of the results, for callers that process them in bulk
+    const float *GetPositions(int axis) const { return m_Positions[axis]; }
+
+    const float *GetVelocities(int axis) const { return m_Velocities[axis]; }
+
+private:
+    size_t m_Count;
+    int m_Types[Capacity];
+    int m_Times[Capacity];
+    int m_Durations[Capacity];
+    CACHE_ALIGN float m_Base[3][Capacity];
+    CACHE_ALIGN float m_Delta[3][Capacity];
+    CACHE_ALIGN float m_PositionScales[Capacity];
+    CACHE_ALIGN float m_VelocityScales[Capacity];
+    CACHE_ALIGN float m_GravityTimes[Capacity];
+    CACHE_ALIGN float m_Positions[3][Capacity];
+    CACHE_ALIGN float m_Velocities[3][Capacity];
+
+    // Fills the last vector with stationary trajectories so it can be processed whole
+    size_t PadToVector()
+    {
+        size_t paddedCount = (m_Count + 3) & ~static_cast<size_t>(3);
+
+        for (size_t i = m_Count; i < paddedCount; i++)
+        {
+            m_Types[i] = TRAJECTORY_STATIONARY;
+            for (int axis = 0; axis < 3; axis++)
+                m_Base[axis][i] = m_Delta[axis][i] = 0.0f;
+        }
+
+        return paddedCount;
+    }
+
+    void ComputeScales(int atTime, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            TrajectoryScales scales = GetTrajectoryScales(m_Types[i], m_Times[i], m_Durations[i], atTime);
+            m_PositionScales[i] = scales.position;
+            m_VelocityScales[i] = scales.velocity;
+            m_GravityTimes[i] = scales.gravityTime;
+        }
+    }
+};
@@ -0,0 +1,197 @@
+// Compares the plugin's arena and object pool with the C heap on a host
+//
+// g++ -O2 -std=c++11 -I../src arena_bench.cpp -o arena_bench && ./arena_bench
+//
+// Checks alignment, rewinding, running out of memory and pool reuse first. Then times the two
+// ways the plugin uses them: scratch arrays taken during a frame and all dropped at the end of
+// it, and detours and commands allocated and freed one at a time
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arena.h"
+
+#define BENCH_ARENA_SIZE (256 * 1024)
+#define BENCH_FRAMES 20000
+#define BENCH_ALLOCATIONS_PER_FRAME 64
+#define BENCH_POOL_CAPACITY 256
+#define BENCH_POOL_ROUNDS 20000
+
+static uint8_t g_ArenaMemory[BENCH_ARENA_SIZE];
+static int g_Failures = 0;
+static volatile uintptr_t g_Sink = 0;
+
+struct PooledObject
+{
+    void *pSource;
+    const void *pDestination;
+    size_t index;
+    uint32_t original[4];
+};
+
+void Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Failures++;
+    }
+}
+
+void TestArena()
+{
+    Arena arena(g_ArenaMemory, sizeof(g_ArenaMemory));
+
+    void *pByte = arena.Allocate(1, 1);
+    double *pDouble = arena.AllocateArray<double>(3);
+    void *pAligned = arena.Allocate(16, 128);
+    Check(pByte != nullptr && pDouble != nullptr && pAligned != nullptr, "small allocations succeed");
+    Check(reinterpret_cast<uintptr_t>(pDouble) % __alignof(double) == 0, "arrays are aligned for their type");
+    Check(reinterpret_cast<uintptr_t>(pAligned) % 128 == 0, "explicit alignment is honored");
+
+    size_t position = arena.GetPosition();
+    void *pScratch = arena.Allocate(1000);
+    arena.Rewind(position);
+    Check(arena.Allocate(1000) == pScratch, "rewinding reuses the scratch memory");
+
+    Check(arena.Allocate(BENCH_ARENA_SIZE) == nullptr, "an allocation that doesn't fit fails");
+    Check(arena.GetFailureCount() == 1, "the failure is counted");
+    Check(arena.GetPeakBytes() >= arena.GetUsedBytes(), "peak covers the current use");
+
+    arena.Reset();
+    Check(arena.GetUsedBytes() == 0 && arena.Allocate(BENCH_ARENA_SIZE, 1) != nullptr, "reset gives the whole arena back");
+}
+
+void TestObjectPool()
+{
+    Arena arena(g_ArenaMemory, sizeof(g_ArenaMemory));
+    ObjectPool<PooledObject> pool;
+    Check(pool.Init(&arena, BENCH_POOL_CAPACITY), "pool fits in the arena");
+
+    std::vector<PooledObject *> objects;
+    for (int i = 0; i < BENCH_POOL_CAPACITY; i++)
+        objects.push_back(pool.Allocate());
+
+    Check(objects.back() != nullptr, "every slot can be taken");
+    Check(pool.Allocate() == nullptr && pool.GetFailureCount() == 1, "a full pool fails and counts it");
+
+    PooledObject *pFreed = objects[BENCH_POOL_CAPACITY / 2];
+    pool.Free(pFreed);
+    Check(pool.Allocate() == pFreed, "a freed slot is taken next");
+    Check(pool.Owns(pFreed) && !pool.Owns(&objects), "ownership checks");
+
+    pool.Reset();
+    Check(pool.GetLiveCount() == 0 && pool.Allocate() != nullptr, "reset frees every slot");
+}
+
+double ElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Sizes like the plugin's frame scratch, small candidate lists up to a buffer for every entity
+size_t ScratchSize(int i)
+{
+    static const size_t sizes[] = { 16, 64, 256, 1024, 4096 };
+    return sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+}
+
+void MeasureFrameScratch()
+{
+    Arena arena(g_ArenaMemory, sizeof(g_ArenaMemory));
+    void *pointers[BENCH_ALLOCATIONS_PER_FRAME];
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        arena.Reset();
+        for (int i = 0; i < BENCH_ALLOCATIONS_PER_FRAME; i++)
+        {
+            pointers[i] = arena.Allocate(ScratchSize(i));
+            static_cast<uint8_t *>(pointers[i])[0] = static_cast<uint8_t>(i);
+        }
+
+        g_Sink += reinterpret_cast<uintptr_t>(pointers[frame % BENCH_ALLOCATIONS_PER_FRAME]);
+    }
+    double arenaNs = ElapsedNs(start) / (static_cast<double>(BENCH_FRAMES) * BENCH_ALLOCATIONS_PER_FRAME);
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < BENCH_FRAMES; frame++)
+    {
+        for (int i = 0; i < BENCH_ALLOCATIONS_PER_FRAME; i++)
+        {
+            pointers[i] = malloc(ScratchSize(i));
+            static_cast<uint8_t *>(pointers[i])[0] = static_cast<uint8_t>(i);
+        }
+
+        g_Sink += reinterpret_cast<uintptr_t>(pointers[frame % BENCH_ALLOCATIONS_PER_FRAME]);
+
+        for (int i = 0; i < BENCH_ALLOCATIONS_PER_FRAME; i++)
+            free(pointers[i]);
+    }
+    double mallocNs = ElapsedNs(start) / (static_cast<double>(BENCH_FRAMES) * BENCH_ALLOCATIONS_PER_FRAME);
+
+    printf("frame scratch: arena %.2f ns, malloc/free %.2f ns per allocation, %.1fx\n", arenaNs, mallocNs, mallocNs / arenaNs);
+}
+
+// Frees in a shuffled order so the free list doesn't just hand back the last slot
+void MeasureObjectPool()
+{
+    Arena arena(g_ArenaMemory, sizeof(g_ArenaMemory));
+    ObjectPool<PooledObject> pool;
+    pool.Init(&arena, BENCH_POOL_CAPACITY);
+
+    PooledObject *objects[BENCH_POOL_CAPACITY];
+    size_t order[BENCH_POOL_CAPACITY];
+    srand(1);
+    for (size_t i = 0; i < BENCH_POOL_CAPACITY; i++)
+        order[i] = i;
+    for (size_t i = BENCH_POOL_CAPACITY - 1; i > 0; i--)
+    {
+        size_t j = rand() % (i + 1);
+        size_t swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_POOL_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < BENCH_POOL_CAPACITY; i++)
+            objects[i] = pool.Allocate();
+
+        g_Sink += reinterpret_cast<uintptr_t>(objects[round % BENCH_POOL_CAPACITY]);
+
+        for (size_t i = 0; i < BENCH_POOL_CAPACITY; i++)
+            pool.Free(objects[order[i]]);
+    }
+    double poolNs = ElapsedNs(start) / (static_cast<double>(BENCH_POOL_ROUNDS) * BENCH_POOL_CAPACITY);
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BENCH_POOL_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < BENCH_POOL_CAPACITY; i++)
+            objects[i] = new PooledObject();
+
+        g_Sink += reinterpret_cast<uintptr_t>(objects[round % BENCH_POOL_CAPACITY]);
+
+        for (size_t i = 0; i < BENCH_POOL_CAPACITY; i++)
+            delete objects[order[i]];
+    }
+    double heapNs = ElapsedNs(start) / (static_cast<double>(BENCH_POOL_ROUNDS) * BENCH_POOL_CAPACITY);
+
+    printf("object pool: pool %.2f ns, new/delete %.2f ns per allocate and free, %.1fx\n", poolNs, heapNs, heapNs / poolNs);
+}
+
+int main()
+{
+    TestArena();
+    TestObjectPool();
+    MeasureFrameScratch();
+    MeasureObjectPool();
+
+    printf("%s\n", g_Failures == 0 ? "all checks passed" : "some checks failed");
+    return g_Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Receives the metrics packets published by the `metrics <ip> [port]` console command and
+writes them as InfluxDB line protocol or CSV
+
+Usage: metrics_collector.py [--port 28970] [--format line|csv] [--count N] [--output file]
+       metrics_collector.py --mock --count 5
+
+--mock also sends made up packets to the collector over loopback, to try the collector and the
+protocol without a console
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+METRICS_MAGIC = 0x4957334D
+METRICS_VERSION = 1
+METRICS_DEFAULT_PORT = 28970
+
+# Same order as MetricsPacket in src/metrics.h, after magic, version, fieldCount and sequence
+FIELDS = [
+    "server_time",
+    "frames",
+    "frame_interval_p50",
+    "frame_interval_p99",
+    "frame_interval_max",
+    "frame_spikes",
+    "scheduler_us",
+    "scheduler_over_budget_frames",
+    "plugin_frame_p50_us",
+    "plugin_frame_p99_us",
+    "plugin_frame_max_us",
+    "client_think_p50_us",
+    "client_think_p99_us",
+    "client_think_max_us",
+    "client_command_p50_us",
+    "client_command_p99_us",
+    "client_command_max_us",
+    "link_entity_p50_us",
+    "link_entity_p99_us",
+    "link_entity_max_us",
+    "connected_clients",
+    "in_game_clients",
+    "netchan_dropped",
+    "commands_dropped",
+    "commands_duplicated",
+    "worst_command_age_p99",
+    "entities",
+    "pooled_entities",
+    "pooled_entities_allocated",
+    "native_movers",
+    "culled_entities",
+    "deferred_links",
+    "flushed_links",
+    "plugin_arena_bytes",
+    "frame_arena_peak_bytes",
+    "command_lookups",
+    "log_dropped",
+    "trace_events",
+]
+
+HEADER_FIELDS = 4
+
+
+def decode(data):
+    """Returns (sequence, {field: value}) or raises ValueError"""
+    if len(data) < HEADER_FIELDS * 4 or len(data) % 4 != 0:
+        raise ValueError("bad packet size %d" % len(data))
+
+    values = struct.unpack(">%dI" % (len(data) // 4), data)
+    magic, version, field_count, sequence = values[:HEADER_FIELDS]
+    if magic != METRICS_MAGIC:
+        raise ValueError("bad magic %08x" % magic)
+    if version < 1:
+        raise ValueError("bad version %d" % version)
+    if field_count != len(values):
+        raise ValueError("packet has %d fields, header says %d" % (len(values), field_count))
+
+    # Newer publishers only add fields at the end, the ones this collector doesn't know are skipped
+    known = values[HEADER_FIELDS:HEADER_FIELDS + len(FIELDS)]
+    return sequence, dict(zip(FIELDS, known))
+
+
+def encode(sequence, fields):
+    """Builds a packet the way the plugin does, fields missing from the dict are 0"""
+    values = [METRICS_MAGIC, METRICS_VERSION, HEADER_FIELDS + len(FIELDS), sequence]
+    values += [fields.get(name, 0) & 0xFFFFFFFF for name in FIELDS]
+    return struct.pack(">%dI" % len(values), *values)
+
+
+def format_line(source, sequence, fields, timestamp):
+    values = ",".join("%s=%di" % (name, value) for name, value in fields.items())
+    return "iw3xenon,source=%s sequence=%di,%s %d" % (source, sequence, values, int(timestamp * 1e9))
+
+
+def format_csv_header(fields):
+    return "timestamp,source,sequence," + ",".join(fields)
+
+
+def format_csv(source, sequence, fields, timestamp):
+    return "%.3f,%s,%d,%s" % (timestamp, source, sequence, ",".join(str(value) for value in fields.values()))
+
+
+def run_mock_publisher(port, count, interval, stop):
+    publisher = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sequence = 0
+
+    while not stop.is_set() and (count == 0 or sequence < count):
+        fields = {name: (index + 1) * 10 + sequence for index, name in enumerate(FIELDS)}
+        fields["server_time"] = 50 * sequence
+        fields["frames"] = 20 * sequence
+        publisher.sendto(encode(sequence, fields), ("127.0.0.1", port))
+        sequence += 1
+        time.sleep(interval)
+
+    publisher.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Collects iw3xenon metrics packets")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=METRICS_DEFAULT_PORT)
+    parser.add_argument("--format", choices=["line", "csv"], default="line")
+    parser.add_argument("--count", type=int, default=0, help="exit after this many packets, 0 to run forever")
+    parser.add_argument("--output", help="file to append to instead of stdout")
+    parser.add_argument("--mock", action="store_true", help="also publish made up packets over loopback")
+    parser.add_argument("--interval", type=float, default=0.1, help="seconds between mock packets")
+    args = parser.parse_args()
+
+    receiver = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    receiver.bind(("127.0.0.1" if args.mock else args.bind, args.port))
+    receiver.settimeout(5.0 if args.mock else None)
+
+    output = open(args.output, "a") if args.output else sys.stdout
+    stop = threading.Event()
+
+    if args.mock:
+        mock = threading.Thread(target=run_mock_publisher, args=(args.port, args.count, args.interval, stop))
+        mock.daemon = True
+        mock.start()
+
+    received = 0
+    errors = 0
+    last_sequence = {}
+
+    if args.format == "csv":
+        output.write(format_csv_header(FIELDS) + "\n")
+
+    try:
+        while args.count == 0 or received < args.count:
+            try:
+                data, address = receiver.recvfrom(2048)
+            except socket.timeout:
+                sys.stderr.write("no packet received\n")
+                errors += 1
+                break
+
+            source = "%s:%d" % address
+            try:
+                sequence, fields = decode(data)
+            except ValueError as error:
+                sys.stderr.write("%s: %s\n" % (source, error))
+                errors += 1
+                continue
+
+            previous = last_sequence.get(source)
+            if previous is not None and sequence != (previous + 1) & 0xFFFFFFFF:
+                sys.stderr.write("%s: %d packets lost\n" % (source, (sequence - previous - 1) & 0xFFFFFFFF))
+            last_sequence[source] = sequence
+
+            timestamp = time.time()
+            if args.format == "csv":
+                output.write(format_csv(source, sequence, fields, timestamp) + "\n")
+            else:
+                output.write(format_line(source, sequence, fields, timestamp) + "\n")
+
+            output.flush()
+            received += 1
+    except KeyboardInterrupt:
+        pass
+    finally:
+        stop.set()
+        receiver.close()
+        if output is not sys.stdout:
+            output.close()
+
+    return 1 if errors != 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,208 @@
+// Stress and throughput test for the plugin's thread pool on a host
+//
+// g++ -O2 -std=c++11 -pthread -I../src thread_pool_stress.cpp -o thread_pool_stress && ./thread_pool_stress
+//
+// Checks that every job runs exactly once and every completion is either run or counted as
+// dropped, with several threads submitting at once, with bursts far apart enough for the
+// workers to go to sleep, and across Start/Stop cycles. Then measures jobs per second
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+#define STRESS_WORKERS 4
+#define STRESS_JOBS 1000000
+#define STRESS_PRODUCERS 3
+#define STRESS_BURSTS 200
+#define STRESS_BURST_JOBS 50
+#define STRESS_CYCLES 50
+
+static volatile int32_t g_Sum = 0;
+static volatile int32_t g_Completions = 0;
+static int g_Failures = 0;
+
+void AddJob(void *pContext)
+{
+    Atomic_Add(&g_Sum, static_cast<int32_t>(reinterpret_cast<intptr_t>(pContext)));
+}
+
+// Completions only run on the thread calling RunCompletions, a plain increment would do but
+// the counter is read from the checks too
+void CountCompletion(void *)
+{
+    Atomic_Increment(&g_Completions);
+}
+
+void Check(bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        g_Failures++;
+    }
+}
+
+// Submits until the pool takes the job, running completions meanwhile so a full completion
+// queue doesn't turn into drops. Only the main thread passes runCompletions
+void SubmitRetrying(ThreadPool *pPool, intptr_t value, bool withCompletion, bool runCompletions)
+{
+    while (!pPool->Submit(AddJob, reinterpret_cast<void *>(value), withCompletion ? CountCompletion : nullptr))
+    {
+        if (runCompletions)
+            pPool->RunCompletions(64);
+
+        Thread_Yield();
+    }
+}
+
+void WaitForExecuted(ThreadPool *pPool, int32_t count)
+{
+    while (pPool->GetExecutedCount() < count)
+    {
+        pPool->RunCompletions(64);
+        Thread_Yield();
+    }
+
+    pPool->RunCompletions(COMPLETION_QUEUE_CAPACITY);
+}
+
+void ResetCounters()
+{
+    g_Sum = 0;
+    g_Completions = 0;
+}
+
+// Every job from the main thread and from the producers runs once, completions from the main
+// thread's jobs all come back
+void TestManyProducers()
+{
+    const uint32_t hardwareThreads[STRESS_WORKERS] = { 0, 1, 2, 3 };
+    ThreadPool pool;
+    Check(pool.Start(hardwareThreads, STRESS_WORKERS), "pool starts");
+    ResetCounters();
+
+    const int perThread = STRESS_JOBS / (STRESS_PRODUCERS + 1);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < STRESS_PRODUCERS; p++)
+    {
+        producers.push_back(std::thread([&pool, perThread]() {
+            for (int i = 0; i < perThread; i++)
+                SubmitRetrying(&pool, 1, false, false);
+        }));
+    }
+
+    int withCompletion = 0;
+    for (int i = 0; i < perThread; i++)
+    {
+        bool complete = i % 10 == 0;
+        withCompletion += complete;
+        SubmitRetrying(&pool, 1, complete, true);
+    }
+
+    for (size_t p = 0; p < producers.size(); p++)
+        producers[p].join();
+
+    int32_t total = perThread * (STRESS_PRODUCERS + 1);
+    WaitForExecuted(&pool, total);
+
+    Check(g_Sum == total, "every job ran once");
+    Check(pool.GetExecutedCount() == total, "executed count");
+    Check(g_Completions + pool.GetCompletionsDroppedCount() == withCompletion, "every completion ran or was counted as dropped");
+
+    printf(
+        "producers: %d jobs, %d stolen, %d rejected and retried, %d completions, %d dropped, %d wakeups\n",
+        total,
+        pool.GetStolenCount(),
+        pool.GetRejectedCount(),
+        g_Completions,
+        pool.GetCompletionsDroppedCount(),
+        pool.GetWakeupCount()
+    );
+}
+
+// Bursts far enough apart that every worker goes to sleep in between, a burst that isn't
+// picked up means a lost wakeup and hangs here
+void TestSleepingWorkers()
+{
+    const uint32_t hardwareThreads[STRESS_WORKERS] = { 0, 1, 2, 3 };
+    ThreadPool pool;
+    pool.Start(hardwareThreads, STRESS_WORKERS);
+    ResetCounters();
+
+    double worstUs = 0.0;
+    double totalUs = 0.0;
+
+    for (int burst = 0; burst < STRESS_BURSTS; burst++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1 + burst % 3));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < STRESS_BURST_JOBS; i++)
+            SubmitRetrying(&pool, 1, false, true);
+
+        WaitForExecuted(&pool, (burst + 1) * STRESS_BURST_JOBS);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        totalUs += us;
+        if (us > worstUs)
+            worstUs = us;
+    }
+
+    Check(g_Sum == STRESS_BURSTS * STRESS_BURST_JOBS, "every burst ran");
+    printf("sleeping workers: %d bursts, %.1f us average, %.1f us worst, %d wakeups\n", STRESS_BURSTS, totalUs / STRESS_BURSTS, worstUs, pool.GetWakeupCount());
+}
+
+// Stopping with jobs still queued drops them and the pool starts again cleanly
+void TestStartStop()
+{
+    const uint32_t hardwareThreads[STRESS_WORKERS] = { 0, 1, 2, 3 };
+    ThreadPool pool;
+
+    for (int cycle = 0; cycle < STRESS_CYCLES; cycle++)
+    {
+        Check(pool.Start(hardwareThreads, 1 + cycle % STRESS_WORKERS), "pool restarts");
+        for (int i = 0; i < 500; i++)
+            pool.Submit(AddJob, reinterpret_cast<void *>(1), CountCompletion);
+
+        pool.Stop();
+        Check(!pool.IsRunning(), "pool stops");
+        Check(pool.RunCompletions(COMPLETION_QUEUE_CAPACITY) == 0, "completions are dropped on stop");
+    }
+
+    printf("start/stop: %d cycles\n", STRESS_CYCLES);
+}
+
+void MeasureThroughput()
+{
+    const uint32_t hardwareThreads[STRESS_WORKERS] = { 0, 1, 2, 3 };
+
+    for (size_t workers = 1; workers <= STRESS_WORKERS; workers++)
+    {
+        ThreadPool pool;
+        pool.Start(hardwareThreads, workers);
+        ResetCounters();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < STRESS_JOBS; i++)
+            SubmitRetrying(&pool, 1, false, true);
+
+        WaitForExecuted(&pool, STRESS_JOBS);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("throughput: %u workers, %.2f M jobs/s, %d stolen\n", static_cast<unsigned>(workers), STRESS_JOBS / seconds / 1e6, pool.GetStolenCount());
+    }
+}
+
+int main()
+{
+    TestManyProducers();
+    TestSleepingWorkers();
+    TestStartStop();
+    MeasureThroughput();
+
+    printf("%s\n", g_Failures == 0 ? "all checks passed" : "some checks failed");
+    return g_Failures == 0 ? 0 : 1;
+}
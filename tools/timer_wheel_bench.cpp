@@ -0,0 +1,254 @@
+// Compares the plugin's timer wheel with a binary heap on a host, at 10k to 100k pending timers
+//
+// g++ -O2 -std=c++11 -I../src timer_wheel_bench.cpp -o timer_wheel_bench && ./timer_wheel_bench
+//
+// Every tick about 1% of the pending timers are cancelled and as many new ones scheduled, with
+// delays of up to 10 minutes at 20 ticks per second, like scripts that start a countdown per
+// player or entity and often cancel it
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "timer_wheel.h"
+
+#define BENCH_TICKS 2000
+#define BENCH_MAX_DELAY 12000
+#define BENCH_CAPACITY 262144
+
+static uint64_t g_Fired = 0;
+
+void CountFired(void *, uint32_t)
+{
+    g_Fired++;
+}
+
+// Min heap on expiry with the position of every timer kept so cancelling is O(log n). Ids carry
+// a generation like the wheel's handles so a stale id doesn't cancel the timer reusing its slot
+class TimerHeap
+{
+public:
+    explicit TimerHeap(size_t capacity)
+        : m_Positions(capacity, -1), m_Generations(capacity, 1), m_Now(0)
+    {
+        for (size_t i = capacity; i > 0; i--)
+            m_Free.push_back(static_cast<uint32_t>(i - 1));
+
+        m_Heap.reserve(capacity);
+        m_Expiries.resize(capacity);
+    }
+
+    uint32_t Schedule(uint32_t delay)
+    {
+        uint32_t id = m_Free.back();
+        m_Free.pop_back();
+
+        m_Expiries[id] = m_Now + (delay != 0 ? delay : 1);
+        m_Heap.push_back(id);
+        m_Positions[id] = static_cast<int32_t>(m_Heap.size() - 1);
+        SiftUp(m_Heap.size() - 1);
+        return (m_Generations[id] << TIMER_INDEX_BITS) | id;
+    }
+
+    bool Cancel(uint32_t handle)
+    {
+        uint32_t id = handle & TIMER_INDEX_MASK;
+        int32_t position = m_Positions[id];
+        if (position == -1 || m_Generations[id] != handle >> TIMER_INDEX_BITS)
+            return false;
+
+        RemoveAt(static_cast<size_t>(position));
+        return true;
+    }
+
+    size_t Advance()
+    {
+        m_Now++;
+        size_t fired = 0;
+
+        while (!m_Heap.empty() && m_Expiries[m_Heap[0]] <= m_Now)
+        {
+            RemoveAt(0);
+            CountFired(nullptr, 0);
+            fired++;
+        }
+
+        return fired;
+    }
+
+    size_t GetPendingCount() const { return m_Heap.size(); }
+
+private:
+    std::vector<uint32_t> m_Heap;
+    std::vector<int32_t> m_Positions;
+    std::vector<uint32_t> m_Generations;
+    std::vector<uint32_t> m_Expiries;
+    std::vector<uint32_t> m_Free;
+    uint32_t m_Now;
+
+    void Place(size_t position, uint32_t id)
+    {
+        m_Heap[position] = id;
+        m_Positions[id] = static_cast<int32_t>(position);
+    }
+
+    void SiftUp(size_t position)
+    {
+        uint32_t id = m_Heap[position];
+        while (position > 0)
+        {
+            size_t parent = (position - 1) / 2;
+            if (m_Expiries[m_Heap[parent]] <= m_Expiries[id])
+                break;
+
+            Place(position, m_Heap[parent]);
+            position = parent;
+        }
+
+        Place(position, id);
+    }
+
+    void SiftDown(size_t position)
+    {
+        uint32_t id = m_Heap[position];
+        size_t count = m_Heap.size();
+
+        for (;;)
+        {
+            size_t child = position * 2 + 1;
+            if (child >= count)
+                break;
+            if (child + 1 < count && m_Expiries[m_Heap[child + 1]] < m_Expiries[m_Heap[child]])
+                child++;
+            if (m_Expiries[m_Heap[child]] >= m_Expiries[id])
+                break;
+
+            Place(position, m_Heap[child]);
+            position = child;
+        }
+
+        Place(position, id);
+    }
+
+    void RemoveAt(size_t position)
+    {
+        uint32_t id = m_Heap[position];
+        uint32_t last = m_Heap.back();
+        m_Heap.pop_back();
+        m_Positions[id] = -1;
+        if (++m_Generations[id] >> (32 - TIMER_INDEX_BITS) != 0)
+            m_Generations[id] = 1;
+        m_Free.push_back(id);
+
+        if (position < m_Heap.size())
+        {
+            Place(position, last);
+            SiftUp(position);
+            SiftDown(m_Positions[last]);
+        }
+    }
+};
+
+struct BenchResult
+{
+    double scheduleNs;
+    double cancelNs;
+    double tickUs;
+    uint64_t fired;
+};
+
+double ElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Schedule and Cancel are called through these so both structures run the same workload
+template<typename Timers>
+BenchResult Run(Timers *pTimers, size_t pendingCount, uint32_t (*schedule)(Timers *, uint32_t), bool (*cancel)(Timers *, uint32_t))
+{
+    BenchResult result = { 0.0, 0.0, 0.0, 0 };
+    std::vector<uint32_t> handles;
+    handles.reserve(pendingCount * 2);
+    srand(1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pendingCount; i++)
+        handles.push_back(schedule(pTimers, 1 + rand() % BENCH_MAX_DELAY));
+    result.scheduleNs = ElapsedNs(start) / pendingCount;
+
+    uint64_t firedBefore = g_Fired;
+    size_t churn = pendingCount / 100;
+    double cancelTotal = 0.0;
+    double tickTotal = 0.0;
+
+    for (int tick = 0; tick < BENCH_TICKS; tick++)
+    {
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < churn; i++)
+        {
+            size_t victim = rand() % handles.size();
+            cancel(pTimers, handles[victim]);
+            handles[victim] = handles.back();
+            handles.pop_back();
+        }
+        cancelTotal += ElapsedNs(start);
+
+        // New timers replace the cancelled and fired ones so the pending count stays put
+        while (handles.size() < pendingCount)
+            handles.push_back(schedule(pTimers, 1 + rand() % BENCH_MAX_DELAY));
+
+        start = std::chrono::steady_clock::now();
+        pTimers->Advance();
+        tickTotal += ElapsedNs(start);
+    }
+
+    result.cancelNs = cancelTotal / (static_cast<double>(churn) * BENCH_TICKS);
+    result.tickUs = tickTotal / BENCH_TICKS / 1000.0;
+    result.fired = g_Fired - firedBefore;
+    return result;
+}
+
+static TimerWheel<BENCH_CAPACITY> g_Wheel;
+
+uint32_t ScheduleWheel(TimerWheel<BENCH_CAPACITY> *pWheel, uint32_t delay)
+{
+    return pWheel->Schedule(delay, CountFired, nullptr);
+}
+
+bool CancelWheel(TimerWheel<BENCH_CAPACITY> *pWheel, uint32_t handle)
+{
+    return pWheel->Cancel(handle);
+}
+
+uint32_t ScheduleHeap(TimerHeap *pHeap, uint32_t delay)
+{
+    return pHeap->Schedule(delay);
+}
+
+bool CancelHeap(TimerHeap *pHeap, uint32_t handle)
+{
+    return pHeap->Cancel(handle);
+}
+
+int main()
+{
+    const size_t pendingCounts[] = { 10000, 25000, 50000, 100000 };
+
+    printf("%8s %6s %12s %12s %12s %10s\n", "pending", "", "schedule ns", "cancel ns", "tick us", "fired");
+
+    for (size_t i = 0; i < sizeof(pendingCounts) / sizeof(pendingCounts[0]); i++)
+    {
+        // Fired and cancelled handles are stale, stale cancels are part of the workload
+        g_Wheel.Reset();
+        BenchResult wheel = Run(&g_Wheel, pendingCounts[i], ScheduleWheel, CancelWheel);
+
+        TimerHeap heap(BENCH_CAPACITY);
+        BenchResult binaryHeap = Run(&heap, pendingCounts[i], ScheduleHeap, CancelHeap);
+
+        printf("%8u %6s %12.1f %12.1f %12.2f %10llu\n", static_cast<unsigned>(pendingCounts[i]), "wheel", wheel.scheduleNs, wheel.cancelNs, wheel.tickUs, static_cast<unsigned long long>(wheel.fired));
+        printf("%8s %6s %12.1f %12.1f %12.2f %10llu\n", "", "heap", binaryHeap.scheduleNs, binaryHeap.cancelNs, binaryHeap.tickUs, static_cast<unsigned long long>(binaryHeap.fired));
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Converts a trace dump written by the `trace dump` console command to the Chrome trace
+event format, which can be opened in about:tracing or https://ui.perfetto.dev
+
+Usage: trace2json.py iw3xenon_0.trace [output.json]
+"""
+
+import json
+import struct
+import sys
+
+TRACE_FILE_MAGIC = 0x49573354
+TRACE_FILE_VERSION = 1
+TRACE_UNKNOWN_NAME = 0xFFFF
+
+TRACE_EVENT_BEGIN = 0
+TRACE_EVENT_END = 1
+TRACE_EVENT_INSTANT = 2
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.offset = 0
+
+    def read(self, fmt):
+        values = struct.unpack_from(fmt, self.data, self.offset)
+        self.offset += struct.calcsize(fmt)
+        return values
+
+    def read_bytes(self, length):
+        value = self.data[self.offset:self.offset + length]
+        if len(value) != length:
+            raise ValueError("truncated file")
+        self.offset += length
+        return value
+
+
+def read_dump(data):
+    reader = Reader(data)
+    magic, version, ticks_per_second, name_count, thread_count = reader.read(">IIQII")
+    if magic != TRACE_FILE_MAGIC:
+        raise ValueError("not a trace dump")
+    if version != TRACE_FILE_VERSION:
+        raise ValueError("unsupported version %d" % version)
+
+    names = []
+    for _ in range(name_count):
+        (length,) = reader.read(">H")
+        names.append(reader.read_bytes(length).decode("latin-1"))
+
+    threads = []
+    for _ in range(thread_count):
+        thread_id, event_count = reader.read(">II")
+        events = []
+        for _ in range(event_count):
+            time, name_index, event_type, _reserved, arg = reader.read(">QHBBI")
+            name = names[name_index] if name_index != TRACE_UNKNOWN_NAME and name_index < len(names) else "?"
+            events.append((time, name, event_type, arg))
+        threads.append((thread_id, events))
+
+    return ticks_per_second, threads
+
+
+def convert(ticks_per_second, threads):
+    times = [event[0] for _, events in threads for event in events]
+    start = min(times) if times else 0
+    trace_events = []
+
+    for thread_id, events in threads:
+        trace_events.append({
+            "name": "thread_name",
+            "ph": "M",
+            "pid": 1,
+            "tid": thread_id,
+            "args": {"name": "thread %x" % thread_id},
+        })
+
+        # The ring may have overwritten the begin of the oldest spans, their ends are dropped.
+        # Spans still open at the end are left open, the viewers draw them up to the last event
+        depth = 0
+        for time, name, event_type, arg in events:
+            event = {
+                "name": name,
+                "pid": 1,
+                "tid": thread_id,
+                "ts": (time - start) * 1000000.0 / ticks_per_second,
+            }
+
+            if event_type == TRACE_EVENT_BEGIN:
+                depth += 1
+                event["ph"] = "B"
+                event["args"] = {"arg": arg}
+            elif event_type == TRACE_EVENT_END:
+                if depth == 0:
+                    continue
+                depth -= 1
+                event["ph"] = "E"
+            elif event_type == TRACE_EVENT_INSTANT:
+                event["ph"] = "i"
+                event["s"] = "t"
+                event["args"] = {"arg": arg}
+            else:
+                continue
+
+            trace_events.append(event)
+
+    return {"traceEvents": trace_events, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(sys.argv[1], "rb") as file:
+        ticks_per_second, threads = read_dump(file.read())
+
+    output_path = sys.argv[2] if len(sys.argv) == 3 else sys.argv[1] + ".json"
+    with open(output_path, "w") as file:
+        json.dump(convert(ticks_per_second, threads), file)
+
+    event_count = sum(len(events) for _, events in threads)
+    print("%d events on %d threads written to %s" % (event_count, len(threads), output_path))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,158 @@
+// Compares the plugin's batched trajectory evaluation with the scalar reference on a host
+//
+// g++ -O2 -std=c++11 -I../src trajectory_bench.cpp -o trajectory_bench && ./trajectory_bench
+//
+// Every supported type is mixed in one batch, durations of 0 included, and evaluated at times
+// before, during and after the move. The batched results have to match the scalar ones within
+// BENCH_TOLERANCE and never be NaN. Then both paths are timed on batches of the sizes the plugin
+// uses, native movers and every entity of a level
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "trajectory.h"
+
+#define BENCH_CAPACITY 1024
+#define BENCH_ACCURACY_TIMES 200
+#define BENCH_ITERATIONS 20000
+#define BENCH_TOLERANCE 0.01f
+
+static const int g_Types[] = {
+    TRAJECTORY_STATIONARY,
+    TRAJECTORY_INTERPOLATE,
+    TRAJECTORY_LINEAR,
+    TRAJECTORY_LINEAR_STOP,
+    TRAJECTORY_SINE,
+    TRAJECTORY_GRAVITY,
+    TRAJECTORY_ACCELERATE,
+    TRAJECTORY_DECELERATE,
+};
+
+static TrajectoryBatch<BENCH_CAPACITY> g_Batch;
+static TrajectoryBatch<BENCH_CAPACITY> g_Reference;
+static volatile float g_Sink = 0.0f;
+
+float RandomFloat(float range)
+{
+    return (static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f) * range;
+}
+
+// Both batches get the same trajectories, a quarter of every type has a duration of 0
+void FillBatches(size_t count)
+{
+    g_Batch.Clear();
+    g_Reference.Clear();
+    srand(1);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int type = g_Types[i % (sizeof(g_Types) / sizeof(g_Types[0]))];
+        int time = rand() % 10000;
+        int duration = (i / 8) % 4 == 0 ? 0 : 50 + rand() % 5000;
+        float base[3] = { RandomFloat(4096.0f), RandomFloat(4096.0f), RandomFloat(4096.0f) };
+        float delta[3] = { RandomFloat(600.0f), RandomFloat(600.0f), RandomFloat(600.0f) };
+
+        g_Batch.Add(type, time, duration, base, delta);
+        g_Reference.Add(type, time, duration, base, delta);
+    }
+}
+
+// Relative to the magnitude of the values so large coordinates don't dominate
+float Difference(float a, float b)
+{
+    float magnitude = fabsf(b) > 1.0f ? fabsf(b) : 1.0f;
+    return fabsf(a - b) / magnitude;
+}
+
+bool CheckAccuracy(size_t count)
+{
+    FillBatches(count);
+
+    float worstPosition = 0.0f;
+    float worstVelocity = 0.0f;
+    size_t nans = 0;
+
+    for (int step = 0; step < BENCH_ACCURACY_TIMES; step++)
+    {
+        int atTime = -1000 + step * 100;
+        g_Batch.Evaluate(atTime);
+        g_Reference.EvaluateScalar(atTime);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float *pPositions = g_Batch.GetPositions(axis);
+            const float *pVelocities = g_Batch.GetVelocities(axis);
+            const float *pReferencePositions = g_Reference.GetPositions(axis);
+            const float *pReferenceVelocities = g_Reference.GetVelocities(axis);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (pPositions[i] != pPositions[i] || pVelocities[i] != pVelocities[i] || pReferencePositions[i] != pReferencePositions[i] || pReferenceVelocities[i] != pReferenceVelocities[i])
+                {
+                    nans++;
+                    continue;
+                }
+
+                float position = Difference(pPositions[i], pReferencePositions[i]);
+                float velocity = Difference(pVelocities[i], pReferenceVelocities[i]);
+                if (position > worstPosition)
+                    worstPosition = position;
+                if (velocity > worstVelocity)
+                    worstVelocity = velocity;
+            }
+        }
+    }
+
+    bool passed = nans == 0 && worstPosition <= BENCH_TOLERANCE && worstVelocity <= BENCH_TOLERANCE;
+    printf("accuracy: %u trajectories, worst relative difference %g position %g velocity, %u NaN, %s\n", static_cast<unsigned>(count), worstPosition, worstVelocity, static_cast<unsigned>(nans), passed ? "ok" : "FAILED");
+    return passed;
+}
+
+template<typename Evaluate>
+double MeasureNs(size_t count, Evaluate evaluate)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+        evaluate(i);
+    double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    return ns / BENCH_ITERATIONS / count;
+}
+
+void Evaluate(int atTime)
+{
+    g_Batch.Evaluate(atTime);
+    g_Sink += g_Batch.GetPositions(2)[0];
+}
+
+void EvaluateScalar(int atTime)
+{
+    g_Reference.EvaluateScalar(atTime);
+    g_Sink += g_Reference.GetPositions(2)[0];
+}
+
+void MeasureThroughput(size_t count)
+{
+    FillBatches(count);
+
+    double batchedNs = MeasureNs(count, Evaluate);
+    double scalarNs = MeasureNs(count, EvaluateScalar);
+
+    printf("throughput: %4u trajectories, batched %.2f ns, scalar %.2f ns per trajectory, %.2fx\n", static_cast<unsigned>(count), batchedNs, scalarNs, scalarNs / batchedNs);
+}
+
+int main()
+{
+    const size_t counts[] = { 7, 64, 256, BENCH_CAPACITY };
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+        passed &= CheckAccuracy(counts[i]);
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+        MeasureThroughput(counts[i]);
+
+    printf("%s\n", passed ? "all checks passed" : "some checks failed");
+    return passed ? 0 : 1;
+}